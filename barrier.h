@@ -0,0 +1,69 @@
+// Thread barrier
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef BARRIER_H
+#define BARRIER_H
+
+#include <condition_variable>
+#include <mutex>
+
+
+// Reusable barrier for a fixed number of threads
+class Barrier
+{
+  public:
+    Barrier (int num_threads);
+    void Wait ();                     // Block until all threads arrived
+  private:
+    std::mutex mutex_;
+    std::condition_variable all_arrived_;
+    int num_threads_;                 // Number of participating threads
+    int num_waiting_;                 // Threads arrived in this generation
+    int generation_;                  // Number of completed generations
+};
+
+
+inline Barrier::Barrier (int num_threads)
+: num_threads_(num_threads)
+, num_waiting_(0)
+, generation_(0)
+{}
+
+
+inline void Barrier::Wait ()
+{
+  std::unique_lock<std::mutex> lock (mutex_);
+  int generation = generation_;
+  if (++num_waiting_ == num_threads_)
+  {
+    num_waiting_ = 0;
+    ++generation_;
+    all_arrived_.notify_all ();
+  }
+  else
+  {
+    while (generation == generation_)
+      all_arrived_.wait (lock);
+  }
+}
+
+#endif
@@ -0,0 +1,592 @@
+// Benchmarks of parsing, learning, evaluation and model files
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cstdio>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include "tiny_log.h"
+
+#include "data_set.h"
+#include "learner_binary.h"
+#include "learner_multiclass.h"
+#include "learner_multilabel.h"
+#include "model.h"
+#include "sparse_kernels.h"
+#include "synthetic_data.h"
+
+namespace po = boost::program_options;
+
+
+// Timings of one benchmark
+struct BenchResult
+{
+  BenchResult (const std::string &bench_name, size_t num_items)
+    : name(bench_name), items(num_items), evaluated(false), result(0) {}
+  std::string name;                   // Phase and program
+  size_t items;                       // Instances or weights per run
+  std::vector<double> seconds;        // Wall time of each repetition
+  bool  evaluated;                    // Model was evaluated
+  float result;                       // Result of evaluation
+};
+
+
+static double Seconds (std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double> (
+    std::chrono::steady_clock::now () - start).count ();
+}
+
+
+static double TimeParse (const std::string &data_file)
+{
+  std::chrono::steady_clock::time_point start
+    = std::chrono::steady_clock::now ();
+  DataSet data_set (0);
+  if (!data_set.Read (data_file.c_str ()))
+    return -1;
+  return Seconds (start);
+}
+
+
+// Time Run of a learner with the given options, return -1 on failure.
+// The result of an evaluation is stored in result unless it is NULL.
+template <typename LearnerType>
+static double TimeRun (const std::vector<std::string> &args,
+  float *result = NULL)
+{
+  std::vector<char *> argv (1, const_cast<char *> ("sol-bench"));
+  for (size_t i = 0; i < args.size (); ++i)
+    argv.push_back (const_cast<char *> (args[i].c_str ()));
+  LearnerType learner;
+  if (learner.Init (argv.size (), argv.data ()))
+    return -1;
+  std::chrono::steady_clock::time_point start
+    = std::chrono::steady_clock::now ();
+  if (learner.Run ())
+    return -1;
+  double seconds = Seconds (start);
+  if (result)
+    *result = learner.result ();
+  return seconds;
+}
+
+
+// TimeRun of sol-bin, sol-mucl or sol-mulab
+static double TimeProgram (int program, const std::vector<std::string> &args,
+  float *result = NULL)
+{
+  if (program == 0)
+    return TimeRun<BinaryLearner> (args, result);
+  if (program == 1)
+    return TimeRun<MultiClassLearner> (args, result);
+  return TimeRun<MultiLabelLearner> (args, result);
+}
+
+
+static double TimeModelRead (const std::string &model_file,
+  int num_submodels, int num_features)
+{
+  std::chrono::steady_clock::time_point start
+    = std::chrono::steady_clock::now ();
+  Model model;
+  model.Init (num_submodels, num_features);
+  model.Read (model_file.c_str ());
+  return Seconds (start);
+}
+
+
+static double TimeModelWrite (const std::string &model_in,
+  const std::string &model_out, Model::Format format, int num_submodels,
+  int num_features)
+{
+  Model model;
+  model.Init (num_submodels, num_features);
+  model.Read (model_in.c_str ());
+  std::chrono::steady_clock::time_point start
+    = std::chrono::steady_clock::now ();
+  model.Write (model_out.c_str (), format);
+  return Seconds (start);
+}
+
+
+static std::string ToString (int value)
+{
+  std::ostringstream oss;
+  oss << value;
+  return oss.str ();
+}
+
+
+// Instances of one density for kernel benchmarks, stored back to back
+// with float values and counts
+struct KernelData
+{
+  std::vector<id_t>    ids;
+  std::vector<float>   values;
+  std::vector<uint8_t> counts;
+  std::vector<int>     offsets;       // Start of each instance, and end
+};
+
+
+// Time one pass of SparseDot or SparseAxpy over all instances with values
+// in the given encoding
+static double TimeKernel (const KernelData &data, std::vector<float> &weights,
+  bool axpy, DataSet::Encoding encoding)
+{
+  static volatile float sink;
+  float sum = 0;
+  std::chrono::steady_clock::time_point start
+    = std::chrono::steady_clock::now ();
+  for (size_t i = 0; i + 1 < data.offsets.size (); ++i)
+  {
+    int begin = data.offsets[i];
+    SparseVectorView x (&data.ids[begin],
+      (encoding == DataSet::kValuesFloat) ? &data.values[begin] : NULL,
+      data.offsets[i + 1] - begin, 0, 0,
+      (encoding == DataSet::kValuesCounts) ? &data.counts[begin] : NULL);
+    if (axpy)
+      sum += SparseAxpy (weights.data (), x, (i % 2) ? 0.01 : -0.01, 1.0);
+    else
+      sum += SparseDot (weights.data (), x);
+  }
+  double seconds = Seconds (start);
+  sink = sum;
+  return seconds;
+}
+
+
+// Benchmark the supported kernel sets at several instance densities for
+// each value encoding, items are non-zero instance values
+static void BenchKernels (int num_features,
+  SyntheticData::Distribution distribution, double exponent, unsigned seed,
+  int repetitions, std::vector<BenchResult> &results)
+{
+  const int kNumDensities = 5;
+  const int densities[kNumDensities] = { 8, 32, 128, 512, 2048 };
+  const int kValuesPerDensity = 1 << 22;
+  const KernelSet sets[] = { kKernelsScalar, kKernelsAVX2, kKernelsAVX512 };
+  const int kNumEncodings = 3;
+  const struct { const char *name; DataSet::Encoding encoding; }
+    encodings[kNumEncodings] = { { "", DataSet::kValuesFloat },
+      { "-counts", DataSet::kValuesCounts },
+      { "-binary", DataSet::kValuesBinary } };
+  std::vector<float> weights (num_features + 1, 0);
+  for (int d = 0; d < kNumDensities; ++d)
+  {
+    KernelData data;
+    SyntheticData generator (num_features, densities[d], distribution,
+      exponent, seed);
+    std::vector<id_t>  ids;
+    std::vector<float> values;
+    data.offsets.push_back (0);
+    while (data.ids.size () < kValuesPerDensity)
+    {
+      generator.Draw (ids, values);
+      data.ids.insert (data.ids.end (), ids.begin (), ids.end ());
+      data.values.insert (data.values.end (), values.begin (), values.end ());
+      for (size_t k = 0; k < values.size (); ++k)
+        data.counts.push_back (uint8_t (values[k] * 10) + 1);
+      data.offsets.push_back (data.ids.size ());
+    }
+    for (size_t k = 0; k < sizeof (sets) / sizeof (sets[0]); ++k)
+    {
+      if (!SelectKernels (sets[k]))
+        continue;
+      for (int e = 0; e < kNumEncodings; ++e)
+      {
+        std::string suffix = encodings[e].name + std::string ("/")
+          + KernelSetName (sets[k]) + "/" + ToString (densities[d]);
+        BenchResult dot  ("kernel-dot" + suffix, data.ids.size ());
+        BenchResult axpy ("kernel-axpy" + suffix, data.ids.size ());
+        for (int r = 0; r < repetitions; ++r)
+        {
+          dot.seconds.push_back (TimeKernel (data, weights, false,
+            encodings[e].encoding));
+          axpy.seconds.push_back (TimeKernel (data, weights, true,
+            encodings[e].encoding));
+        }
+        results.push_back (dot);
+        results.push_back (axpy);
+      }
+    }
+  }
+  SelectKernels (kKernelsAuto);
+}
+
+
+static double Median (std::vector<double> seconds)
+{
+  std::sort (seconds.begin (), seconds.end ());
+  size_t n = seconds.size ();
+  return (n % 2) ? seconds[n / 2] : (seconds[n / 2 - 1] + seconds[n / 2]) / 2;
+}
+
+
+int main (int argc, char **argv)
+{
+  int num_instances;
+  int num_features;
+  int density;
+  SyntheticData::Distribution distribution;
+  double exponent;
+  int num_classes;
+  int num_labels;
+  int num_iterations;
+  int repetitions;
+  unsigned seed;
+  std::string work_dir;
+  std::string format;
+  std::string generate;
+  SyntheticData::Targets targets;
+  bool keep_files;
+  bool kernels_only;
+
+  po::options_description options ("Allowed options",
+    po::options_description::m_default_line_length);
+  options.add_options ()
+    ("help,h", "display this help message")
+    ("num-instances,n",
+      po::value<int> (&num_instances)->default_value (50000),
+      "number of instances")
+    ("num-features,f",
+      po::value<int> (&num_features)->default_value (100000),
+      "number of features (ids 1 ... arg)")
+    ("density", po::value<int> (&density)->default_value (50),
+      "features drawn per instance")
+    ("distribution", po::value<SyntheticData::Distribution> (&distribution)
+      ->default_value (SyntheticData::kIdsUniform, "uniform"),
+      "distribution of feature ids (uniform | zipf)")
+    ("exponent", po::value<double> (&exponent)->default_value (1.0),
+      "exponent of zipf distribution")
+    ("num-classes,c", po::value<int> (&num_classes)->default_value (10),
+      "number of classes (sol-mucl)")
+    ("num-labels", po::value<int> (&num_labels)->default_value (8),
+      "number of labels (sol-mulab)")
+    ("num-iterations,i",
+      po::value<int> (&num_iterations)->default_value (0, "num-instances"),
+      "number of learning iterations")
+    ("repetitions,r", po::value<int> (&repetitions)->default_value (3),
+      "runs of each benchmark")
+    ("random-seed", po::value<unsigned> (&seed)->default_value (1),
+      "random seed of data and learning")
+    ("work-dir", po::value<std::string> (&work_dir)->default_value ("/tmp"),
+      "directory of generated files")
+    ("keep-files", po::value<bool> (&keep_files)->zero_tokens ()
+      ->default_value (false), "keep generated files")
+    ("kernels", po::value<bool> (&kernels_only)->zero_tokens ()
+      ->default_value (false), "only benchmark sparse kernels")
+    ("format", po::value<std::string> (&format)->default_value ("csv"),
+      "format of results (csv | json)")
+    ("generate", po::value<std::string> (&generate)->default_value (""),
+      "only write data to file, - for stdout")
+    ("targets", po::value<SyntheticData::Targets> (&targets)
+      ->default_value (SyntheticData::kTargetsMultiClass, "multiclass"),
+      "targets of generated data (binary | multiclass | multilabel)")
+    ("verbosity", po::value<int> (), "verbosity level (0 ... 7)")
+  ;
+  po::variables_map vm;
+  po::store (po::parse_command_line (argc, argv, options), vm);
+  po::notify (vm);
+  if (vm.count ("help"))
+  {
+    std::cerr << options << std::endl;
+    return 1;
+  }
+  int verbosity = vm.count ("verbosity") ? vm["verbosity"].as<int> () : 2;
+  TinyLog::SetLevel (TinyLog::Level (verbosity));
+  if (repetitions < 1)
+  {
+    FATAL << "repetitions must be at least 1" << std::endl;
+    return 1;
+  }
+  if (num_iterations <= 0)
+    num_iterations = num_instances;
+
+  // Generate data only
+  SyntheticData generator (num_features, density, distribution, exponent,
+    seed);
+  if (generate != "")
+  {
+    int classes = (targets == SyntheticData::kTargetsMultiLabel) ?
+      num_labels : num_classes;
+    if (generate == "-")
+    {
+      generator.Write (std::cout, num_instances, targets, classes);
+      return 0;
+    }
+    return generator.Write (generate.c_str (), num_instances, targets,
+      classes) ? 0 : 1;
+  }
+
+  std::vector<BenchResult> results;
+  if (!kernels_only)
+  {
+    // One data set per program
+    const int kNumPrograms = 3;
+    const char *programs[kNumPrograms] = { "sol-bin", "sol-mucl", "sol-mulab" };
+    SyntheticData::Targets program_targets[kNumPrograms] = 
+    {
+      SyntheticData::kTargetsBinary, 
+      SyntheticData::kTargetsMultiClass, 
+      SyntheticData::kTargetsMultiLabel
+    };
+    int program_submodels[kNumPrograms] = { 1, num_classes, num_labels };
+    std::string prefix = work_dir + "/sol-bench.";
+    std::vector<std::string> files;
+    for (int p = 0; p < kNumPrograms; ++p)
+    {
+      std::string data  = prefix + programs[p] + ".txt";
+      std::string cache = prefix + programs[p] + ".cache";
+      std::string model = prefix + programs[p] + ".model";
+      files.push_back (data);
+      files.push_back (cache);
+      files.push_back (model);
+
+      INFO << "generating " << data << " ..." << std::endl;
+      BenchResult generate_result (std::string ("generate/") + programs[p],
+        size_t (num_instances));
+      std::chrono::steady_clock::time_point start
+        = std::chrono::steady_clock::now ();
+      if (!generator.Write (data.c_str (), num_instances, program_targets[p],
+        program_submodels[p]))
+      {
+        FATAL << "Could not write " << data << std::endl;
+        return 1;
+      }
+      generate_result.seconds.push_back (Seconds (start));
+      results.push_back (generate_result);
+
+      // Parsing
+      BenchResult parse (std::string ("parse/") + programs[p],
+        size_t (num_instances));
+      for (int r = 0; r < repetitions; ++r)
+        parse.seconds.push_back (TimeParse (data));
+      results.push_back (parse);
+
+      // Learning and evaluation read the data from the cache, which is
+      // written by an untimed run together with the model for evaluation
+      std::vector<std::string> args;
+      args.push_back ("--input-file");
+      args.push_back (data);
+      args.push_back ("--data-cache");
+      args.push_back (cache);
+      args.push_back ("--random-seed");
+      args.push_back (ToString (seed));
+      args.push_back ("--verbosity");
+      args.push_back (ToString (verbosity));
+      if (p > 0)
+      {
+        args.push_back ("-c");
+        args.push_back (ToString (program_submodels[p]));
+      }
+      std::vector<std::string> learn_args (args);
+      learn_args.push_back ("-l");
+      learn_args.push_back ("-i");
+      learn_args.push_back (ToString (num_iterations));
+      std::vector<std::string> prepare_args (learn_args);
+      prepare_args.push_back ("--model-out");
+      prepare_args.push_back (model);
+      prepare_args.push_back ("--model-format");
+      prepare_args.push_back ("binary");
+      std::vector<std::string> eval_args (args);
+      eval_args.push_back ("-e");
+      eval_args.push_back ("--model-in");
+      eval_args.push_back (model);
+
+      BenchResult learn (std::string ("learn/") + programs[p],
+        size_t (num_iterations));
+      BenchResult eval  (std::string ("evaluate/") + programs[p],
+        size_t (num_instances));
+      if (TimeProgram (p, prepare_args) < 0)
+      {
+        FATAL << "Could not learn from " << data << std::endl;
+        return 1;
+      }
+      for (int r = 0; r < repetitions; ++r)
+      {
+        learn.seconds.push_back (TimeProgram (p, learn_args));
+        eval.seconds.push_back (TimeProgram (p, eval_args, &eval.result));
+      }
+      eval.evaluated  = true;
+      learn.evaluated = true;
+      learn.result    = eval.result;
+      results.push_back (learn);
+      results.push_back (eval);
+
+      // Learning with 16 bit weights. The result is that of the learned
+      // model on the data, for comparison with the float weights above.
+      const int kNumPrecisions = 2;
+      const char *precisions[kNumPrecisions] = { "bf16", "fp16" };
+      for (int k = 0; k < kNumPrecisions; ++k)
+      {
+        std::string model_16 = prefix + programs[p] + "." + precisions[k]
+          + ".model";
+        files.push_back (model_16);
+        std::vector<std::string> learn_16 (learn_args);
+        learn_16.push_back ("--weight-precision");
+        learn_16.push_back (precisions[k]);
+        std::vector<std::string> prepare_16 (learn_16);
+        prepare_16.push_back ("--model-out");
+        prepare_16.push_back (model_16);
+        prepare_16.push_back ("--model-format");
+        prepare_16.push_back ("binary");
+        std::vector<std::string> eval_16 (args);
+        eval_16.push_back ("-e");
+        eval_16.push_back ("--model-in");
+        eval_16.push_back (model_16);
+
+        BenchResult learn_result (std::string ("learn/") + programs[p]
+          + "/" + precisions[k], size_t (num_iterations));
+        if ((TimeProgram (p, prepare_16) < 0)
+          || (TimeProgram (p, eval_16, &learn_result.result) < 0))
+        {
+          FATAL << "Could not learn from " << data << " with "
+            << precisions[k] << " weights" << std::endl;
+          return 1;
+        }
+        learn_result.evaluated = true;
+        for (int r = 0; r < repetitions; ++r)
+          learn_result.seconds.push_back (TimeProgram (p, learn_16));
+        results.push_back (learn_result);
+      }
+    }
+
+    // Model files of the multi-class model, items are weights
+    std::string model_in  = prefix + "sol-mucl.model";
+    std::string model_txt = prefix + "model.txt";
+    std::string model_bin = prefix + "model.bin";
+    files.push_back (model_txt);
+    files.push_back (model_bin);
+    size_t num_weights = size_t (num_classes) * (num_features + 1);
+    BenchResult write_text   ("model-write/text", num_weights);
+    BenchResult read_text    ("model-read/text", num_weights);
+    BenchResult write_binary ("model-write/binary", num_weights);
+    BenchResult read_binary  ("model-read/binary", num_weights);
+    for (int r = 0; r < repetitions; ++r)
+    {
+      write_text.seconds.push_back (TimeModelWrite (model_in, model_txt,
+        Model::kFormatText, num_classes, num_features + 1));
+      read_text.seconds.push_back (TimeModelRead (model_txt, num_classes,
+        num_features + 1));
+      write_binary.seconds.push_back (TimeModelWrite (model_in, model_bin,
+        Model::kFormatBinary, num_classes, num_features + 1));
+      read_binary.seconds.push_back (TimeModelRead (model_bin, num_classes,
+        num_features + 1));
+    }
+    results.push_back (write_text);
+    results.push_back (read_text);
+    results.push_back (write_binary);
+    results.push_back (read_binary);
+
+    if (!keep_files)
+    {
+      for (size_t i = 0; i < files.size (); ++i)
+        remove (files[i].c_str ());
+    }
+  }
+  BenchKernels (num_features, distribution, exponent, seed, repetitions,
+    results);
+
+  // Write results with the fastest and the median run. Failed benchmarks
+  // have no timings or result, null in JSON and empty fields in CSV.
+  std::ostringstream config;
+  const char *distribution_name = (distribution == SyntheticData::kIdsZipf) ?
+    "zipf" : "uniform";
+  if (format == "json")
+  {
+    std::cout << "{\n  \"config\": {\"num_instances\": " << num_instances 
+      << ", \"num_features\": " << num_features
+      << ", \"density\": " << density
+      << ", \"distribution\": \"" << distribution_name << '"'
+      << ", \"exponent\": " << exponent
+      << ", \"num_classes\": " << num_classes
+      << ", \"num_labels\": " << num_labels
+      << ", \"num_iterations\": " << num_iterations
+      << ", \"repetitions\": " << repetitions
+      << ", \"random_seed\": " << seed << "},\n  \"results\": [";
+  }
+  else
+  {
+    std::cout << "benchmark,num_instances,num_features,density,distribution,"
+      "num_classes,num_labels,items,repetitions,min_seconds,median_seconds,"
+      "items_per_second,result\n";
+    config << num_instances << ',' << num_features << ',' << density << ','
+      << distribution_name << ',' << num_classes << ',' << num_labels;
+  }
+  for (size_t i = 0; i < results.size (); ++i)
+  {
+    const BenchResult &result = results[i];
+    double min = *std::min_element (result.seconds.begin (),
+      result.seconds.end ());
+    double median = Median (result.seconds);
+    bool failed = (min < 0);
+    if (failed)
+      WARN << result.name << " failed" << std::endl;
+    if (format == "json")
+    {
+      std::cout << (i ? "," : "") << "\n    {\"benchmark\": \"" 
+        << result.name << "\", \"items\": " << result.items
+        << ", \"repetitions\": " << result.seconds.size ();
+      if (failed)
+        std::cout << ", \"min_seconds\": null, \"median_seconds\": null"
+          << ", \"items_per_second\": null";
+      else
+        std::cout << ", \"min_seconds\": " << min
+          << ", \"median_seconds\": " << median
+          << ", \"items_per_second\": " << result.items / min;
+      if (result.evaluated)
+      {
+        std::cout << ", \"result\": ";
+        if (failed)
+          std::cout << "null";
+        else
+          std::cout << result.result;
+      }
+      std::cout << "}";
+    }
+    else
+    {
+      std::cout << result.name << ',' << config.str () << ','
+        << result.items << ',' << result.seconds.size () << ',';
+      if (failed)
+        std::cout << ",,,";
+      else
+      {
+        std::cout << min << ',' << median << ',' << result.items / min << ',';
+        if (result.evaluated)
+          std::cout << result.result;
+      }
+      std::cout << '\n';
+    }
+  }
+  if (format == "json")
+    std::cout << "\n  ]\n}\n";
+  return 0;
+}
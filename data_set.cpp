@@ -20,8 +20,21 @@
 // along with Sol.  If not, see <http://www.gnu.org/licenses/>.
 
 
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
 #include <fstream>
+#include <functional>
 #include <string>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "tiny_log.h"
 
@@ -29,34 +42,526 @@
 #include "sparse_data_format.h"
 
 
-DataSet::DataSet (int num_instances)
+// Binary cache file format. The header is followed by the CSR arrays
+// offsets (num_instances + 1 size_t), targets and norms (num_instances
+// floats each), ids (num_nonzeros id_t) and values (num_nonzeros floats,
+// bytes or nothing, depending on the encoding). All arrays are stored in
+// native byte order and mapped as they are.
+const char     kCacheMagic[8] = { 'S', 'O', 'L', 'D', 'A', 'T', 'A', 0 };
+const uint32_t kCacheVersion  = 3;
+
+struct CacheHeader
+{
+  char     magic[8];      // kCacheMagic
+  uint32_t version;       // kCacheVersion
+  uint32_t id_size;       // sizeof (id_t)
+  uint32_t offset_size;   // sizeof (size_t)
+  uint32_t max_id;        // Maximum feature id
+  uint64_t source_size;   // Size of source file in bytes
+  int64_t  source_mtime;  // Modification time of source file
+  uint64_t num_instances; // Number of instances
+  uint64_t num_nonzeros;  // Total number of components
+  uint32_t hash_bits;     // Feature names hashed if > 0
+  uint32_t encoding;      // DataSet::Encoding of values
+};
+
+
+// Bytes per value of an encoding
+static size_t value_size (uint32_t encoding)
+{
+  if (encoding == DataSet::kValuesFloat)
+    return sizeof (float);
+  return (encoding == DataSet::kValuesCounts) ? sizeof (uint8_t) : 0;
+}
+
+
+// Size of a cache file with the given header
+static size_t cache_size (const CacheHeader &header)
+{
+  return sizeof (CacheHeader)
+    + (header.num_instances + 1) * sizeof (size_t)
+    + header.num_instances * 2 * sizeof (float)
+    + header.num_nonzeros * (sizeof (id_t) + value_size (header.encoding));
+}
+
+
+// Narrowest encoding of the values of an instance. Counts are integers
+// from 0 to 255 without the sign of -0.
+static DataSet::Encoding value_encoding (const SparseVectorView &instance)
 {
+  DataSet::Encoding encoding = DataSet::kValuesBinary;
+  for (int i = 0; i < instance.size (); ++i)
+  {
+    float value = instance.value (i);
+    if (value == 1)
+      continue;
+    if (std::signbit (value) || !(value <= 255) || (value != floorf (value)))
+      return DataSet::kValuesFloat;
+    encoding = DataSet::kValuesCounts;
+  }
+  return encoding;
+}
+
+
+DataSet::DataSet (int num_instances, Layout layout, int hash_bits)
+: layout_(layout)
+, hash_bits_(hash_bits)
+, encoding_(kValuesBinary)
+, max_id_(0)
+, mapping_(NULL)
+, mapping_size_(0)
+{
+  offsets_.push_back (0);
   if (num_instances > 0)
-    data_set_.reserve (num_instances);
+  {
+    if (layout_ == kLayoutVectors)
+      data_set_.reserve (num_instances);
+    else
+    {
+      offsets_.reserve (num_instances + 1);
+      targets_.reserve (num_instances);
+      norms_.reserve (num_instances);
+    }
+  }
+  UpdateArrays ();
+}
+
+
+DataSet::~DataSet ()
+{
+  if (mapping_)
+    munmap (mapping_, mapping_size_);
 }
 
 
-id_t DataSet::Read (const char *file_name)
+// Read data set in sparse data format. With num_threads > 1 the file
+// is split into newline aligned chunks, which are parsed concurrently
+// and appended in file order.
+bool DataSet::Read (const char *file_name, int num_threads)
 {
-  std::ifstream ifs (file_name);
+  std::ifstream ifs (file_name, std::ios::binary);
+  if (!ifs)
+  {
+    FATAL << "Can't open '" << file_name << "'" << std::endl;
+    return false;
+  }
+  ifs.seekg (0, std::ios::end);
+  std::streamoff file_size = ifs.tellg ();
+  ifs.close ();
+
+  // Small or unseekable files are read by a single thread
+  const std::streamoff kMinChunkSize = 1 << 20;
+  if (num_threads > file_size / kMinChunkSize)
+    num_threads = file_size / kMinChunkSize;
+  if (num_threads < 1)
+    num_threads = 1;
+
+  // Parse chunks
+  std::vector<DataSet *> chunks;
+  std::vector<std::thread> threads;
+  std::vector<int> line_counts (num_threads, 0);
+  std::vector<int> error_columns (num_threads, 0);
+  if (num_threads == 1)
+    ReadChunk (file_name, 0, size_t (-1), line_counts[0], error_columns[0]);
+  else
+  {
+    for (int t = 0; t < num_threads; ++t)
+    {
+      size_t begin = file_size * t / num_threads;
+      size_t end   = file_size * (t + 1) / num_threads;
+      chunks.push_back (new DataSet (0, layout_, hash_bits_));
+      threads.push_back (std::thread (&DataSet::ReadChunk, chunks[t],
+        file_name, begin, end, std::ref (line_counts[t]), 
+        std::ref (error_columns[t])));
+    }
+    for (int t = 0; t < num_threads; ++t)
+      threads[t].join ();
+  }
+
+  // Report first error with its line number in the whole file
+  bool result = true;
+  int  line_offset = 0;
+  for (int t = 0; t < num_threads; ++t)
+  {
+    if (error_columns[t] > 0)
+    {
+      FATAL << "Error in input:" << line_offset + line_counts[t] << ':'
+        << error_columns[t] << std::endl;
+      result = false;
+      break;
+    }
+    line_offset += line_counts[t];
+  }
+
+  // Merge chunks in file order
+  for (size_t t = 0; t < chunks.size (); ++t)
+  {
+    if (result)
+      Append (*chunks[t]);
+    delete chunks[t];
+  }
+
+  // Release spare capacity of the CSR arrays
+  ids_.shrink_to_fit ();
+  values_.shrink_to_fit ();
+  counts_.shrink_to_fit ();
+  UpdateArrays ();
+  return result;
+}
+
+
+// Parse all lines starting within the byte range [begin, end) of a file.
+// A line starting exactly at begin belongs to this chunk only if begin is
+// the start of the file or preceded by a newline. On error, line_count
+// and error_column give the position of the error relative to begin,
+// otherwise error_column is 0.
+bool DataSet::ReadChunk (const char *file_name, size_t begin, size_t end,
+  int &line_count, int &error_column)
+{
+  std::ifstream ifs (file_name, std::ios::binary);
   std::string line;
-  id_t max_id = 0;
-  int line_count = 0;
+  SparseVector temp;
+  size_t pos = begin;
 
-  while (getline (ifs, line))
+  line_count   = 0;
+  error_column = 0;
+  if (begin > 0)
+  {
+    // Skip partial line, it belongs to the previous chunk
+    ifs.seekg (begin - 1);
+    getline (ifs, line);
+    pos += line.size ();
+  }
+
+  while ((pos < end) && getline (ifs, line))
   {
     line_count++;
-    SparseVector temp;
-    const char *pos = sdf_parse_line (line.c_str (), temp);
-    if (*pos && (*pos != '#'))
+    pos += line.size () + 1;
+    temp.clear ();
+    const char *parsed = sdf_parse_line (line.c_str (), temp, hash_bits_);
+    if (*parsed && (*parsed != '#'))
     {
-      FATAL << "Error in input:" << line_count << ':' 
-        << pos - line.c_str () + 1 << std::endl; 
-      return 0;
+      error_column = parsed - line.c_str () + 1;
+      return false;
     }
-    data_set_.push_back (temp);
-    if (temp.max_id () > max_id)
-      max_id = temp.max_id ();
+    push_back (temp);
   }   
-  return max_id;
+  return true;
+}
+
+
+// Append all instances of chunk and clear it
+void DataSet::Append (DataSet &chunk)
+{
+  if (max_id_ < chunk.max_id_)
+    max_id_ = chunk.max_id_;
+  if (chunk.encoding_ > encoding_)
+    Encode (chunk.encoding_);
+  else if (encoding_ > chunk.encoding_)
+    chunk.Encode (encoding_);
+  if (layout_ == kLayoutVectors)
+  {
+    data_set_.reserve (data_set_.size () + chunk.data_set_.size ());
+    for (size_t i = 0; i < chunk.data_set_.size (); ++i)
+      data_set_.push_back (std::move (chunk.data_set_[i]));
+    std::vector<SparseVector> ().swap (chunk.data_set_);
+    return;
+  }
+
+  size_t base = ids_.size ();
+  ids_.insert (ids_.end (), chunk.ids_.begin (), chunk.ids_.end ());
+  std::vector<id_t> ().swap (chunk.ids_);
+  values_.insert (values_.end (), chunk.values_.begin (),
+    chunk.values_.end ());
+  std::vector<float> ().swap (chunk.values_);
+  counts_.insert (counts_.end (), chunk.counts_.begin (),
+    chunk.counts_.end ());
+  std::vector<uint8_t> ().swap (chunk.counts_);
+  for (size_t i = 1; i < chunk.offsets_.size (); ++i)
+    offsets_.push_back (base + chunk.offsets_[i]);
+  targets_.insert (targets_.end (), chunk.targets_.begin (),
+    chunk.targets_.end ());
+  norms_.insert (norms_.end (), chunk.norms_.begin (), chunk.norms_.end ());
+  UpdateArrays ();
+}
+
+
+// Convert the CSR values to a wider encoding
+void DataSet::Encode (Encoding encoding)
+{
+  if (layout_ == kLayoutCSR)
+  {
+    if (encoding == kValuesCounts)
+      counts_.assign (ids_.size (), 1);
+    else if (encoding_ == kValuesCounts)
+      values_.assign (counts_.begin (), counts_.end ());
+    else
+      values_.assign (ids_.size (), 1);
+    if (encoding == kValuesFloat)
+      std::vector<uint8_t> ().swap (counts_);
+  }
+  encoding_ = encoding;
+  UpdateArrays ();
+}
+
+
+// Map a cache file written by WriteCache. Fails if the cache does not
+// exist, has a different format or does not match the source file's size
+// and modification time.
+bool DataSet::ReadCache (const char *cache_name, const char *source_name)
+{
+  struct stat source_stat;
+  if (stat (source_name, &source_stat) != 0)
+  {
+    WARN << "Can't stat '" << source_name << "'" << std::endl;
+    return false;
+  }
+
+  int fd = open (cache_name, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat cache_stat;
+  if ((fstat (fd, &cache_stat) != 0) 
+    || (size_t (cache_stat.st_size) < sizeof (CacheHeader)))
+  {
+    close (fd);
+    WARN << "Invalid data cache '" << cache_name << "'" << std::endl;
+    return false;
+  }
+  size_t size = cache_stat.st_size;
+  void *mapping = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (mapping == MAP_FAILED)
+  {
+    WARN << "Can't map data cache '" << cache_name << "'" << std::endl;
+    return false;
+  }
+
+  // Validate header
+  const CacheHeader *header = static_cast<const CacheHeader *> (mapping);
+  if ((memcmp (header->magic, kCacheMagic, sizeof (kCacheMagic)) != 0)
+    || (header->version != kCacheVersion)
+    || (header->id_size != sizeof (id_t))
+    || (header->offset_size != sizeof (size_t))
+    || (header->encoding > kValuesFloat)
+    || (cache_size (*header) != size))
+  {
+    WARN << "Invalid data cache '" << cache_name << "'" << std::endl;
+    munmap (mapping, size);
+    return false;
+  }
+  if ((header->source_size != uint64_t (source_stat.st_size))
+    || (header->source_mtime != int64_t (source_stat.st_mtime))
+    || (header->hash_bits != uint32_t (hash_bits_)))
+  {
+    INFO << "Data cache '" << cache_name << "' is outdated" << std::endl;
+    munmap (mapping, size);
+    return false;
+  }
+
+  // Validate offsets once, instances index csr_ids_ unchecked
+  const char *pos = static_cast<const char *> (mapping) + sizeof (CacheHeader);
+  size_t n   = header->num_instances;
+  size_t nnz = header->num_nonzeros;
+  const size_t *offsets = reinterpret_cast<const size_t *> (pos);
+  bool valid = (offsets[0] == 0) && (offsets[n] == nnz);
+  for (size_t i = 0; valid && (i < n); ++i)
+    valid = (offsets[i] <= offsets[i + 1]);
+  if (!valid)
+  {
+    WARN << "Invalid data cache '" << cache_name << "'" << std::endl;
+    munmap (mapping, size);
+    return false;
+  }
+
+  // Replace current content by mapped arrays
+  if (mapping_)
+    munmap (mapping_, mapping_size_);
+  mapping_      = mapping;
+  mapping_size_ = size;
+  layout_       = kLayoutCSR;
+  max_id_       = header->max_id;
+  encoding_     = Encoding (header->encoding);
+  std::vector<SparseVector> ().swap (data_set_);
+  std::vector<id_t> ().swap (ids_);
+  std::vector<float> ().swap (values_);
+  std::vector<uint8_t> ().swap (counts_);
+  std::vector<size_t> (1, 0).swap (offsets_);
+  std::vector<float> ().swap (targets_);
+  std::vector<float> ().swap (norms_);
+
+  csr_offsets_ = offsets;
+  pos += (n + 1) * sizeof (size_t);
+  csr_targets_ = reinterpret_cast<const float *> (pos);
+  pos += n * sizeof (float);
+  csr_norms_   = reinterpret_cast<const float *> (pos);
+  pos += n * sizeof (float);
+  csr_ids_     = reinterpret_cast<const id_t *> (pos);
+  pos += nnz * sizeof (id_t);
+  csr_values_  = NULL;
+  csr_counts_  = NULL;
+  if (encoding_ == kValuesFloat)
+    csr_values_ = reinterpret_cast<const float *> (pos);
+  else if (encoding_ == kValuesCounts)
+    csr_counts_ = reinterpret_cast<const uint8_t *> (pos);
+  csr_size_    = n;
+  return true;
+}
+
+
+// Write data set to a binary cache file. The file is written under a
+// temporary name and renamed afterwards, so concurrent readers never see
+// a partially written cache.
+bool DataSet::WriteCache (const char *cache_name,
+  const char *source_name) const
+{
+  struct stat source_stat;
+  if (stat (source_name, &source_stat) != 0)
+  {
+    WARN << "Can't stat '" << source_name << "'" << std::endl;
+    return false;
+  }
+
+  CacheHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, kCacheMagic, sizeof (kCacheMagic));
+  header.version       = kCacheVersion;
+  header.id_size       = sizeof (id_t);
+  header.offset_size   = sizeof (size_t);
+  header.max_id        = max_id_;
+  header.hash_bits     = hash_bits_;
+  header.source_size   = source_stat.st_size;
+  header.source_mtime  = source_stat.st_mtime;
+  header.num_instances = size ();
+  header.encoding      = encoding_;
+  for (size_t i = 0; i < size (); ++i)
+    header.num_nonzeros += (*this)[i].size ();
+
+  const int kBufSize = 1000;
+  char temp_name[kBufSize];
+  snprintf (temp_name, kBufSize, "%s.%d", cache_name, int (getpid ()));
+  std::ofstream ofs (temp_name, std::ios::binary);
+  ofs.write (reinterpret_cast<const char *> (&header), sizeof (header));
+
+  // Offsets
+  size_t offset = 0;
+  ofs.write (reinterpret_cast<const char *> (&offset), sizeof (offset));
+  for (size_t i = 0; i < size (); ++i)
+  {
+    offset += (*this)[i].size ();
+    ofs.write (reinterpret_cast<const char *> (&offset), sizeof (offset));
+  }
+
+  // Targets and norms
+  for (size_t i = 0; i < size (); ++i)
+  {
+    float target = (*this)[i].target ();
+    ofs.write (reinterpret_cast<const char *> (&target), sizeof (target));
+  }
+  for (size_t i = 0; i < size (); ++i)
+  {
+    float norm = (*this)[i].squaredL2Norm ();
+    ofs.write (reinterpret_cast<const char *> (&norm), sizeof (norm));
+  }
+
+  // Ids and values
+  for (size_t i = 0; i < size (); ++i)
+  {
+    SparseVectorView instance = (*this)[i];
+    ofs.write (reinterpret_cast<const char *> (instance.ids ()),
+      instance.size () * sizeof (id_t));
+  }
+  std::vector<float>   values;
+  std::vector<uint8_t> counts;
+  for (size_t i = 0; (encoding_ != kValuesBinary) && (i < size ()); ++i)
+  {
+    SparseVectorView instance = (*this)[i];
+    values.resize (instance.size ());
+    counts.resize (instance.size ());
+    for (int k = 0; k < instance.size (); ++k)
+    {
+      values[k] = instance.value (k);
+      counts[k] = uint8_t (values[k]);
+    }
+    if (encoding_ == kValuesFloat)
+      ofs.write (reinterpret_cast<const char *> (values.data ()),
+        values.size () * sizeof (float));
+    else
+      ofs.write (reinterpret_cast<const char *> (counts.data ()),
+        counts.size ());
+  }
+
+  ofs.close ();
+  if (!ofs || (rename (temp_name, cache_name) != 0))
+  {
+    WARN << "Can't write data cache '" << cache_name << "'" << std::endl;
+    unlink (temp_name);
+    return false;
+  }
+  return true;
+}
+
+
+void DataSet::push_back (const SparseVector &instance)
+{
+  if (instance.max_id () > max_id_)
+    max_id_ = instance.max_id ();
+  Encoding encoding = value_encoding (instance);
+  if ((encoding > encoding_) && !mapping_)
+    Encode (encoding);
+  if (layout_ == kLayoutVectors)
+  {
+    data_set_.push_back (instance);
+    return;
+  }
+  if (mapping_)
+  {
+    WARN << "Can't append to mapped data set" << std::endl;
+    return;
+  }
+  ids_.insert (ids_.end (), instance.ids (),
+    instance.ids () + instance.size ());
+  for (int i = 0; i < instance.size (); ++i)
+  {
+    if (encoding_ == kValuesFloat)
+      values_.push_back (instance.value (i));
+    else if (encoding_ == kValuesCounts)
+      counts_.push_back (uint8_t (instance.value (i)));
+  }
+  offsets_.push_back (ids_.size ());
+  targets_.push_back (instance.target ());
+  norms_.push_back (instance.squaredL2Norm ());
+  UpdateArrays ();
+}
+
+
+size_t DataSet::memory_usage () const
+{
+  size_t bytes = data_set_.capacity () * sizeof (SparseVector);
+  for (size_t i = 0; i < data_set_.size (); ++i)
+  {
+    bytes += data_set_[i].size () * sizeof (id_t);
+    if (data_set_[i].values ())
+      bytes += data_set_[i].size () * sizeof (float);
+  }
+  bytes += ids_.capacity ()     * sizeof (id_t);
+  bytes += values_.capacity ()  * sizeof (float);
+  bytes += counts_.capacity ();
+  bytes += offsets_.capacity () * sizeof (size_t);
+  bytes += targets_.capacity () * sizeof (float);
+  bytes += norms_.capacity ()   * sizeof (float);
+  bytes += mapping_size_;
+  return bytes;
+}
+
+
+void DataSet::UpdateArrays ()
+{
+  csr_ids_     = ids_.data ();
+  csr_values_  = (encoding_ == kValuesFloat) ? values_.data () : NULL;
+  csr_counts_  = (encoding_ == kValuesCounts) ? counts_.data () : NULL;
+  csr_offsets_ = offsets_.data ();
+  csr_targets_ = targets_.data ();
+  csr_norms_   = norms_.data ();
+  csr_size_    = targets_.size ();
 }
@@ -23,40 +23,103 @@
 #ifndef DATA_SET_H
 #define DATA_SET_H
 
+#include <stdint.h>
+
 #include <vector>
 
 #include "common.h"
 #include "sparse_vector.h"
+#include "sparse_vector_view.h"
 
 
+// Data set of sparse instances. Instances are either kept as separate
+// SparseVectors or packed into a compressed sparse row (CSR) layout with
+// one contiguous array for ids and values each. CSR data sets can be
+// saved to a binary cache file, which later runs map into memory instead
+// of parsing the text file again. Large text files can be parsed by
+// several threads, each working on a newline aligned chunk of the file.
+// With hash_bits > 0, feature names are hashed into the ids
+// 1 ... 2^hash_bits. CSR values are stored in the narrowest encoding that
+// fits all instances: none for binary features, whose values are all 1,
+// bytes for integer counts up to 255 or floats.
 class DataSet
 {
   public:
-    DataSet (int num_instances);
-    id_t Read (const char *file_name);
-    SparseVector operator[] (int index);
-    const SparseVector operator[] (int index) const;
+    typedef enum { kLayoutVectors, kLayoutCSR } Layout; // Storage layout
+    typedef enum { kValuesBinary, kValuesCounts, kValuesFloat } Encoding;
+    DataSet (int num_instances, Layout layout = kLayoutCSR,
+      int hash_bits = 0);
+    ~DataSet ();
+    bool Read (const char *file_name, int num_threads = 1);
+    bool ReadCache  (const char *cache_name, const char *source_name);
+    bool WriteCache (const char *cache_name, const char *source_name) const;
+    void push_back (const SparseVector &instance); // Append instance
+    SparseVectorView operator[] (size_t index) const;
     size_t size () const;
+    id_t   max_id () const;                        // Maximum feature id
+    size_t memory_usage () const;                  // Approx. bytes used
+    Encoding encoding () const;                    // Narrowest for values
   private:
-    std::vector<SparseVector> data_set_;
+    DataSet (const DataSet &copy);                 // Not copyable
+    DataSet &operator= (const DataSet &copy);      // Not assignable
+    void UpdateArrays ();                          // Refresh CSR pointers
+    bool ReadChunk (const char *file_name, size_t begin, size_t end,
+      int &line_count, int &error_column);         // Parse part of file
+    void Append (DataSet &chunk);                  // Move chunk to end
+    void Encode (Encoding encoding);               // Widen CSR values
+
+    Layout layout_;                       // Storage layout
+    int    hash_bits_;                    // Hash feature names if > 0
+    std::vector<SparseVector> data_set_;  // Instances (kLayoutVectors)
+    std::vector<id_t>   ids_;             // Ids of all instances (CSR)
+    std::vector<float>  values_;          // Values of all instances (CSR)
+    std::vector<uint8_t> counts_;         // Values as bytes (CSR)
+    std::vector<size_t> offsets_;         // Start of instance in ids_ (CSR)
+    std::vector<float>  targets_;         // Target values (CSR)
+    std::vector<float>  norms_;           // Squared L2-norms (CSR)
+    Encoding encoding_;                   // Values of all instances
+    const id_t   *csr_ids_;               // CSR arrays, either pointing
+    const float  *csr_values_;            // into the vectors above or into
+    const uint8_t *csr_counts_;           // the mapped cache file. Values
+    const size_t *csr_offsets_;           // and counts are NULL unless
+    const float  *csr_targets_;           // they are the encoding.
+    const float  *csr_norms_;
+    size_t csr_size_;                     // Number of CSR instances
+    id_t   max_id_;                       // Maximum feature id
+    void  *mapping_;                      // Mapped cache file or NULL
+    size_t mapping_size_;                 // Size of mapped cache file
 };
 
 
-inline SparseVector DataSet::operator[] (int index)
+inline SparseVectorView DataSet::operator[] (size_t index) const
 {
-  return data_set_[index];
+  if (layout_ == kLayoutVectors)
+    return SparseVectorView (data_set_[index]);
+  size_t begin = csr_offsets_[index];
+  return SparseVectorView (csr_ids_ + begin,
+    csr_values_ ? csr_values_ + begin : NULL,
+    csr_offsets_[index + 1] - begin, csr_targets_[index], csr_norms_[index],
+    csr_counts_ ? csr_counts_ + begin : NULL);
 }
 
 
-inline const SparseVector DataSet::operator[] (int index) const
+inline size_t DataSet::size () const
 {
-  return data_set_[index];
+  if (layout_ == kLayoutVectors)
+    return data_set_.size ();
+  return csr_size_;
 }
 
 
-inline size_t DataSet::size () const
+inline id_t DataSet::max_id () const
+{
+  return max_id_;
+}
+
+
+inline DataSet::Encoding DataSet::encoding () const
 {
-  return data_set_.size ();
+  return encoding_;
 }
 
 #endif
@@ -0,0 +1,194 @@
+// Implementation of streaming data reader
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <fstream>
+#include <utility>
+
+#include "tiny_log.h"
+
+#include "data_stream.h"
+#include "sparse_data_format.h"
+
+
+// Instances are passed from reader to consumer in blocks of this size
+const int kBlockSize = 1024;
+
+
+DataStream::DataStream (int num_passes, int buffer_size, int shuffle_size,
+  id_t max_id, unsigned seed, int hash_bits)
+: num_passes_(num_passes)
+, max_blocks_(buffer_size / kBlockSize)
+, shuffle_size_(shuffle_size)
+, max_id_(max_id)
+, hash_bits_(hash_bits)
+, done_(false)
+, stop_(false)
+, failed_(false)
+, current_pos_(0)
+, random_(seed)
+{
+  if (max_blocks_ < 1)
+    max_blocks_ = 1;
+}
+
+
+DataStream::~DataStream ()
+{
+  if (reader_.joinable ())
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      stop_ = true;
+    }
+    not_full_.notify_all ();
+    reader_.join ();
+  }
+}
+
+
+bool DataStream::Open (const char *file_name)
+{
+  std::ifstream ifs (file_name);
+  if (!ifs)
+  {
+    FATAL << "Can't open '" << file_name << "'" << std::endl;
+    return false;
+  }
+  file_name_ = file_name;
+  reader_ = std::thread (&DataStream::ReadLoop, this);
+  return true;
+}
+
+
+// Get next instance, drawn at random from the shuffle buffer if enabled.
+// Return false at the end of the last pass or on errors.
+bool DataStream::Next (SparseVector &instance)
+{
+  if (shuffle_size_ <= 1)
+    return NextBuffered (instance);
+
+  // Fill shuffle buffer
+  SparseVector next;
+  while ((int (shuffle_.size ()) < shuffle_size_) && NextBuffered (next))
+    shuffle_.push_back (std::move (next));
+  if (shuffle_.empty ())
+    return false;
+
+  // Draw instance and replace it by the next one or the last one
+  size_t index = random_.Uniform (shuffle_.size ());
+  std::swap (instance, shuffle_[index]);
+  if (NextBuffered (next))
+    shuffle_[index] = std::move (next);
+  else
+  {
+    shuffle_[index] = std::move (shuffle_.back ());
+    shuffle_.pop_back ();
+  }
+  return true;
+}
+
+
+// Get next instance in file order
+bool DataStream::NextBuffered (SparseVector &instance)
+{
+  if (current_pos_ >= current_.size ())
+  {
+    std::unique_lock<std::mutex> lock (mutex_);
+    while (queue_.empty () && !done_)
+      not_empty_.wait (lock);
+    if (queue_.empty ())
+      return false;
+    current_.swap (queue_.front ());
+    queue_.pop_front ();
+    current_pos_ = 0;
+    lock.unlock ();
+    not_full_.notify_one ();
+  }
+  std::swap (instance, current_[current_pos_++]);
+  return true;
+}
+
+
+// Parse the file num_passes_ times into blocks of the queue
+void DataStream::ReadLoop ()
+{
+  bool failed = false;
+  Block block;
+
+  for (int pass = 0; (pass < num_passes_) && !failed; ++pass)
+  {
+    std::ifstream ifs (file_name_.c_str ());
+    std::string line;
+    int line_count = 0;
+
+    while (getline (ifs, line))
+    {
+      line_count++;
+      block.push_back (SparseVector ());
+      const char *pos = sdf_parse_line (line.c_str (), block.back (),
+        hash_bits_);
+      if (*pos && (*pos != '#'))
+      {
+        FATAL << "Error in input:" << line_count << ':' 
+          << pos - line.c_str () + 1 << std::endl; 
+        failed = true;
+      }
+      else if (block.back ().max_id () > max_id_)
+      {
+        FATAL << "Error in input:" << line_count << ": feature id " 
+          << block.back ().max_id () << " exceeds num-features" << std::endl;
+        failed = true;
+      }
+      if (failed)
+      {
+        block.pop_back ();
+        break;
+      }
+      if ((int (block.size ()) >= kBlockSize) && !Push (block))
+        return;
+    }
+  }
+  if (!block.empty () && !Push (block))
+    return;
+
+  std::lock_guard<std::mutex> lock (mutex_);
+  failed_ = failed;
+  done_   = true;
+  not_empty_.notify_all ();
+}
+
+
+// Pass block to the consumer, wait while the queue is full. Return false
+// if the stream is being destroyed.
+bool DataStream::Push (Block &block)
+{
+  std::unique_lock<std::mutex> lock (mutex_);
+  while ((int (queue_.size ()) >= max_blocks_) && !stop_)
+    not_full_.wait (lock);
+  if (stop_)
+    return false;
+  queue_.push_back (Block ());
+  queue_.back ().swap (block);
+  lock.unlock ();
+  not_empty_.notify_one ();
+  return true;
+}
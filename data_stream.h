@@ -0,0 +1,86 @@
+// Header for streaming data reader
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef DATA_STREAM_H
+#define DATA_STREAM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "sampler.h"
+#include "sparse_vector.h"
+
+
+// Stream of instances read from a file in sparse data format. A
+// background thread parses the file, possibly several times, into a
+// bounded buffer. The consumer optionally draws instances at random from
+// a shuffle buffer, so memory use is independent of the file size.
+class DataStream
+{
+  public:
+    DataStream (int num_passes, int buffer_size, int shuffle_size,
+      id_t max_id, unsigned seed, int hash_bits = 0);
+    ~DataStream ();
+    bool Open (const char *file_name);    // Start reading file
+    bool Next (SparseVector &instance);   // Get next instance
+    bool failed () const;                 // Error while reading?
+  private:
+    typedef std::vector<SparseVector> Block;
+    DataStream (const DataStream &copy);            // Not copyable
+    DataStream &operator= (const DataStream &copy); // Not assignable
+    void ReadLoop ();                     // Reader thread
+    bool Push (Block &block);             // Pass block to consumer
+    bool NextBuffered (SparseVector &instance); // Next instance in order
+
+    std::string file_name_;               // Input file
+    int   num_passes_;                    // Passes over the file
+    int   max_blocks_;                    // Capacity of queue_ in blocks
+    int   shuffle_size_;                  // Size of shuffle buffer
+    id_t  max_id_;                        // Maximum allowed feature id
+    int   hash_bits_;                     // Hash feature names if > 0
+    std::thread reader_;                  // Reader thread
+    std::mutex  mutex_;                   // Guards queue_, done_, stop_
+    std::condition_variable not_empty_;   // Signals new blocks or done_
+    std::condition_variable not_full_;    // Signals free space or stop_
+    std::deque<Block> queue_;             // Parsed blocks of instances
+    bool  done_;                          // Reader finished
+    bool  stop_;                          // Reader should stop
+    std::atomic<bool> failed_;            // Reader failed, read unlocked
+    Block current_;                       // Block being consumed
+    size_t current_pos_;                  // Next instance in current_
+    std::vector<SparseVector> shuffle_;   // Shuffle buffer
+    RandomEngine random_;                 // Draws from shuffle buffer
+};
+
+
+inline bool DataStream::failed () const
+{
+  return failed_;
+}
+
+#endif
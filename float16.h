@@ -0,0 +1,129 @@
+// Conversions between float and 16 bit floating point formats
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef FLOAT16_H
+#define FLOAT16_H
+
+#include <cstring>
+
+#include <stdint.h>
+
+
+// Conversions of float to and from bfloat16, the upper half of a float,
+// and IEEE half precision (fp16) with 5 exponent and 10 mantissa bits.
+// Floats are converted by adding a rounding term to the bits that are
+// dropped and truncating them. The term is half a unit in the last place
+// for rounding to nearest even, or random for stochastic rounding, which
+// rounds up with probability proportional to the distance from the lower
+// neighbour. Stochastic rounding is unbiased, so updates smaller than the
+// spacing of 16 bit weights are kept on average.
+
+
+inline uint32_t float_bits (float x)
+{
+  uint32_t bits;
+  memcpy (&bits, &x, sizeof (bits));
+  return bits;
+}
+
+
+inline float bits_float (uint32_t bits)
+{
+  float x;
+  memcpy (&x, &bits, sizeof (x));
+  return x;
+}
+
+
+// Term for truncating the lowest shift bits of bits, from random or, if
+// random is 0, to nearest even
+inline uint32_t rounding_term (uint32_t bits, int shift, uint32_t random)
+{
+  if (random)
+    return random >> (32 - shift);
+  return (uint32_t (1) << (shift - 1)) - 1 + ((bits >> shift) & 1);
+}
+
+
+inline float bf16_to_float (uint16_t h)
+{
+  return bits_float (uint32_t (h) << 16);
+}
+
+
+// Convert to bfloat16, rounded by 32 random bits or to nearest even
+inline uint16_t float_to_bf16 (float x, uint32_t random = 0)
+{
+  uint32_t bits = float_bits (x);
+  if ((bits & 0x7fffffff) > 0x7f800000)
+    return (bits >> 16) | 0x40;       // Quiet NaN
+  return (bits + rounding_term (bits, 16, random)) >> 16;
+}
+
+
+// Subnormals get the exponent of 2^-14 and 2^-14 is subtracted again, as
+// arithmetic on subnormal floats is slow. This is done with masks instead
+// of a branch, zero and non-zero weights alternate unpredictably.
+inline float fp16_to_float (uint16_t h)
+{
+  uint32_t sign     = uint32_t (h & 0x8000) << 16;
+  uint32_t abs      = h & 0x7fff;
+  uint32_t mantissa = h & 0x3ff;
+  if (abs >= 0x7c00)                  // Infinity or quiet NaN
+    return bits_float (sign | 0x7f800000 | (mantissa << 13)
+      | (mantissa ? 0x400000 : 0));
+  uint32_t subnormal = -uint32_t (abs < 0x400);
+  uint32_t bits = (abs << 13) + (uint32_t (112) << 23)
+    + (subnormal & (uint32_t (1) << 23));
+  float value = bits_float (bits) - bits_float (subnormal & 0x38800000);
+  return bits_float (sign | float_bits (value));
+}
+
+
+// Convert to fp16, rounded by 32 random bits or to nearest even. Values
+// beyond the range of fp16 become infinite.
+inline uint16_t float_to_fp16 (float x, uint32_t random = 0)
+{
+  uint32_t bits = float_bits (x);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t abs  = bits & 0x7fffffff;
+  if (abs > 0x7f800000)                // Quiet NaN, upper payload kept
+    return sign | 0x7e00 | ((abs >> 13) & 0x3ff);
+  if (abs >= 0x47800000)
+    return sign | 0x7c00;             // At least 2^16 or infinite
+  if (abs >= 0x38800000)              // Normal, drop 13 mantissa bits
+  {
+    abs -= uint32_t (112) << 23;
+    return sign | ((abs + rounding_term (abs, 13, random)) >> 13);
+  }
+
+  // Subnormal, the mantissa with implicit bit is shifted by at least 14
+  int shift = 126 - int (abs >> 23);
+  if (shift > 31)
+    return sign;
+  uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+  return sign | ((mantissa + rounding_term (mantissa, shift, random))
+    >> shift);
+}
+
+#endif
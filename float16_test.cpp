@@ -0,0 +1,285 @@
+// Unit test for float16 conversions
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cmath>
+
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SOL_X86_F16C
+#include <immintrin.h>
+#endif
+
+#include "float16.h"
+
+
+static int g_failures = 0;
+
+
+static void check (bool ok, const char *what, uint32_t input, uint32_t result,
+  uint32_t expected)
+{
+  if (ok)
+    return;
+  if (g_failures < 20)
+    std::cerr << "FAILED: " << what << " of 0x" << std::hex << input
+      << " is 0x" << result << ", expected 0x" << expected << std::dec
+      << std::endl;
+  ++g_failures;
+}
+
+
+static bool is_nan_fp16 (uint16_t h)
+{
+  return (h & 0x7fff) > 0x7c00;
+}
+
+
+// Value of a finite fp16 number or, for infinity, of 2^16, the value of
+// the next number after the largest one, computed without bit tricks
+static double fp16_value (uint16_t h)
+{
+  int exponent = (h >> 10) & 0x1f;
+  int mantissa = h & 0x3ff;
+  double value = exponent ? ldexp (1024 + mantissa, exponent - 25)
+    : ldexp (mantissa, -24);
+  return (h & 0x8000) ? - value : value;
+}
+
+
+// All fp16 numbers to float and back
+static void test_fp16_exhaustive ()
+{
+  for (uint32_t h = 0; h < 0x10000; ++h)
+  {
+    float x = fp16_to_float (h);
+    if (is_nan_fp16 (h))
+    {
+      check (std::isnan (x), "fp16_to_float", h, float_bits (x), 0x7fc00000);
+      check (float_to_fp16 (x) == (h | 0x200), "fp16 NaN round trip", h,
+        float_to_fp16 (x), h | 0x200);
+      continue;
+    }
+    double expected = ((h & 0x7fff) == 0x7c00) ? INFINITY : fp16_value (h);
+    if (h & 0x8000)
+      expected = ((h & 0x7fff) == 0x7c00) ? - INFINITY : expected;
+    check ((x == expected) && (std::signbit (x) == bool (h & 0x8000)),
+      "fp16_to_float", h, float_bits (x), float_bits (expected));
+    check (float_to_fp16 (x) == h, "fp16 round trip", h, float_to_fp16 (x),
+      h);
+  }
+}
+
+
+// All bfloat16 numbers to float and back
+static void test_bf16_exhaustive ()
+{
+  for (uint32_t h = 0; h < 0x10000; ++h)
+  {
+    float x = bf16_to_float (h);
+    check (float_bits (x) == h << 16, "bf16_to_float", h, float_bits (x),
+      h << 16);
+    uint16_t expected = ((h & 0x7fff) > 0x7f80) ? (h | 0x40) : h;
+    check (float_to_bf16 (x) == expected, "bf16 round trip", h,
+      float_to_bf16 (x), expected);
+  }
+}
+
+
+// Floats at and next to the midpoint between neighbouring fp16 numbers,
+// including subnormals and the overflow to infinity, round to nearest even
+static void test_fp16_boundaries ()
+{
+  for (uint32_t h = 0; h < 0x7c00; ++h)
+  {
+    for (uint32_t sign = 0; sign <= 0x8000; sign += 0x8000)
+    {
+      uint16_t lower = sign | h;
+      uint16_t upper = sign | (h + 1);
+      float mid = (fp16_value (lower) + fp16_value (upper)) / 2;
+      uint16_t even = (h & 1) ? upper : lower;
+      check (float_to_fp16 (mid) == even, "float_to_fp16 midpoint",
+        float_bits (mid), float_to_fp16 (mid), even);
+      float below = nextafterf (mid, 0);
+      float above = nextafterf (mid, sign ? - INFINITY : INFINITY);
+      check (float_to_fp16 (below) == lower, "float_to_fp16 below midpoint",
+        float_bits (below), float_to_fp16 (below), lower);
+      check (float_to_fp16 (above) == upper, "float_to_fp16 above midpoint",
+        float_bits (above), float_to_fp16 (above), upper);
+    }
+  }
+}
+
+
+// Same for bfloat16, whose midpoints are floats with only bit 15 set in
+// the lower half
+static void test_bf16_boundaries ()
+{
+  for (uint32_t h = 0; h < 0x7f80; ++h)
+  {
+    for (uint32_t sign = 0; sign <= 0x8000; sign += 0x8000)
+    {
+      uint32_t mid = ((sign | h) << 16) | 0x8000;
+      uint16_t even = (h & 1) ? (sign | (h + 1)) : (sign | h);
+      check (float_to_bf16 (bits_float (mid)) == even,
+        "float_to_bf16 midpoint", mid, float_to_bf16 (bits_float (mid)),
+        even);
+      check (float_to_bf16 (bits_float (mid - 1)) == (sign | h),
+        "float_to_bf16 below midpoint", mid - 1,
+        float_to_bf16 (bits_float (mid - 1)), sign | h);
+      check (float_to_bf16 (bits_float (mid + 1)) == (sign | (h + 1)),
+        "float_to_bf16 above midpoint", mid + 1,
+        float_to_bf16 (bits_float (mid + 1)), sign | (h + 1));
+    }
+  }
+}
+
+
+// Infinities, NaNs, float subnormals and values beyond the fp16 range
+static void test_special ()
+{
+  const uint32_t cases[][3] = {
+    // float bits, fp16, bf16
+    { 0x00000000, 0x0000, 0x0000 },   // zero
+    { 0x80000000, 0x8000, 0x8000 },   // -0
+    { 0x7f800000, 0x7c00, 0x7f80 },   // infinity
+    { 0xff800000, 0xfc00, 0xff80 },   // -infinity
+    { 0x7fc00000, 0x7e00, 0x7fc0 },   // quiet NaN
+    { 0xffc00000, 0xfe00, 0xffc0 },   // negative quiet NaN
+    { 0x7f800001, 0x7e00, 0x7fc0 },   // signaling NaN, low payload
+    { 0x7fa00000, 0x7f00, 0x7fe0 },   // signaling NaN, high payload
+    { 0x00000001, 0x0000, 0x0000 },   // smallest float subnormal
+    { 0x807fffff, 0x8000, 0x8080 },   // largest negative float subnormal
+    { 0x00400000, 0x0000, 0x0040 },   // float subnormal
+    { 0x477fe000, 0x7bff, 0x4780 },   // 65504, largest fp16
+    { 0x477ff000, 0x7c00, 0x4780 },   // 65520, rounds to infinity
+    { 0x477fefff, 0x7bff, 0x4780 },   // just below 65520
+    { 0x7f7fffff, 0x7c00, 0x7f80 },   // largest float
+    { 0x33000000, 0x0000, 0x3300 },   // 2^-25, half of smallest fp16
+    { 0x33000001, 0x0001, 0x3300 },   // just above 2^-25
+    { 0x387fe000, 0x0400, 0x3880 },   // rounds up to smallest normal
+    { 0x3f800000, 0x3c00, 0x3f80 },   // 1
+  };
+  for (size_t i = 0; i < sizeof (cases) / sizeof (cases[0]); ++i)
+  {
+    float x = bits_float (cases[i][0]);
+    check (float_to_fp16 (x) == cases[i][1], "float_to_fp16", cases[i][0],
+      float_to_fp16 (x), cases[i][1]);
+    check (float_to_bf16 (x) == cases[i][2], "float_to_bf16", cases[i][0],
+      float_to_bf16 (x), cases[i][2]);
+  }
+}
+
+
+// Stochastic rounding is unbiased: with all 2^16 values of the upper random
+// bits, the rounded values average to exactly the input. The lowest random
+// bit is set, as 0 selects rounding to nearest. For fp16 this holds within
+// its range down to 2^-17, where at most 16 random bits are used.
+static void test_stochastic ()
+{
+  const float values[] = { 1.0001f, -3.14159f, 1e-3f, 6.1e-5f, 2e-5f,
+    65000.5f, 1e20f, -1e-30f };
+  for (size_t i = 0; i < sizeof (values) / sizeof (values[0]); ++i)
+  {
+    float x = values[i];
+    double fp16_sum = 0;
+    double bf16_sum = 0;
+    for (uint32_t t = 0; t < 0x10000; ++t)
+    {
+      uint32_t random = (t << 16) | 1;
+      fp16_sum += fp16_to_float (float_to_fp16 (x, random));
+      bf16_sum += bf16_to_float (float_to_bf16 (x, random));
+    }
+    if ((fabsf (x) < 65504) && (fabsf (x) >= ldexpf (1, -17)))
+      check (fp16_sum / 0x10000 == x, "stochastic float_to_fp16",
+        float_bits (x), float_bits (fp16_sum / 0x10000), float_bits (x));
+    check (bf16_sum / 0x10000 == x, "stochastic float_to_bf16",
+      float_bits (x), float_bits (bf16_sum / 0x10000), float_bits (x));
+  }
+}
+
+
+#ifdef SOL_X86_F16C
+__attribute__ ((target ("f16c")))
+static uint16_t f16c_from_float (float x)
+{
+  return _cvtss_sh (x, _MM_FROUND_TO_NEAREST_INT);
+}
+
+
+__attribute__ ((target ("f16c")))
+static float f16c_to_float (uint16_t h)
+{
+  return _cvtsh_ss (h);
+}
+
+
+// Compare with the hardware conversions: all fp16 numbers, all floats at
+// and next to fp16 rounding boundaries and a sample of all floats
+static void test_f16c ()
+{
+  for (uint32_t h = 0; h < 0x10000; ++h)
+  {
+    uint32_t expected = float_bits (f16c_to_float (h));
+    check (float_bits (fp16_to_float (h)) == expected, "fp16_to_float (F16C)",
+      h, float_bits (fp16_to_float (h)), expected);
+    uint32_t mid = (h << 13) | 0x1000;
+    for (uint32_t bits = mid - 1; bits <= mid + 1; ++bits)
+    {
+      for (uint32_t offset = 0; offset <= 0x38000000; offset += 0x38000000)
+      {
+        float x = bits_float ((bits + offset) ^ ((h & 0x8000) << 16));
+        check (float_to_fp16 (x) == f16c_from_float (x),
+          "float_to_fp16 (F16C)", float_bits (x), float_to_fp16 (x),
+          f16c_from_float (x));
+      }
+    }
+  }
+  for (uint64_t bits = 0; bits < (uint64_t (1) << 32); bits += 9973)
+  {
+    float x = bits_float (bits);
+    check (float_to_fp16 (x) == f16c_from_float (x), "float_to_fp16 (F16C)",
+      bits, float_to_fp16 (x), f16c_from_float (x));
+  }
+}
+#endif
+
+
+int main ()
+{
+  test_fp16_exhaustive ();
+  test_bf16_exhaustive ();
+  test_fp16_boundaries ();
+  test_bf16_boundaries ();
+  test_special ();
+  test_stochastic ();
+#ifdef SOL_X86_F16C
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("f16c"))
+    test_f16c ();
+  else
+#endif
+    std::cout << "F16C not supported, not compared" << std::endl;
+  std::cout << (g_failures ? "FAILED" : "passed") << std::endl;
+  return g_failures ? 1 : 0;
+}
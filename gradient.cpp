@@ -0,0 +1,117 @@
+// Implementation of sparse gradient accumulation
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+
+#include "gradient.h"
+
+
+void Gradient::Init (int num_submodels, int num_features, bool sparse)
+{
+  elems_.assign (num_submodels, std::vector<SparseVector::elem_t> ());
+  biases_.assign (num_submodels, 0);
+  touched_.assign (num_submodels, false);
+  positions_.assign (sparse ? 0 : num_features, -1);
+}
+
+
+static bool LessId (const SparseVector::elem_t &a,
+  const SparseVector::elem_t &b)
+{
+  return a.first < b.first;
+}
+
+
+// Add scalar * instance to the weights and scalar to the bias of submodel
+void Gradient::Add (int submodel, float scalar,
+  const SparseVectorView &instance)
+{
+  std::vector<SparseVector::elem_t> &elems = elems_[submodel];
+  for (int i = 0; i < instance.size (); ++i)
+    elems.push_back (SparseVector::elem_t (instance.id (i),
+      scalar * instance.value (i)));
+  biases_[submodel] += scalar;
+  touched_[submodel] = true;
+}
+
+
+bool Gradient::ApplyTo (Model &model)
+{
+  bool model_updated = false;
+  for (int j = 0; j < int (elems_.size ()); ++j)
+  {
+    if (!touched_[j])
+      continue;
+
+    // Merge values of duplicate ids in order of first occurrence or, with
+    // a stable sort, in order of ids. Values of an id are summed in the
+    // order they were added either way.
+    std::vector<SparseVector::elem_t> &elems = elems_[j];
+    merged_ids_.clear ();
+    merged_values_.clear ();
+    if (positions_.empty ())
+    {
+      std::stable_sort (elems.begin (), elems.end (), LessId);
+      for (size_t k = 0; k < elems.size (); ++k)
+      {
+        if (merged_ids_.empty () || (merged_ids_.back () != elems[k].first))
+        {
+          merged_ids_.push_back (elems[k].first);
+          merged_values_.push_back (elems[k].second);
+        }
+        else
+          merged_values_.back () += elems[k].second;
+      }
+    }
+    else
+    {
+      for (size_t k = 0; k < elems.size (); ++k)
+      {
+        int &position = positions_[elems[k].first];
+        if (position < 0)
+        {
+          position = merged_ids_.size ();
+          merged_ids_.push_back (elems[k].first);
+          merged_values_.push_back (elems[k].second);
+        }
+        else
+          merged_values_[position] += elems[k].second;
+      }
+    }
+    float norm = 0;
+    for (size_t k = 0; k < merged_ids_.size (); ++k)
+    {
+      if (!positions_.empty ())
+        positions_[merged_ids_[k]] = -1;
+      norm += merged_values_[k] * merged_values_[k];
+    }
+
+    model[j].PlusEquals (SparseVectorView (merged_ids_.data (),
+      merged_values_.data (), merged_ids_.size (), 0, norm));
+    model[j].set_bias (model[j].bias () + biases_[j]);
+    elems.clear ();
+    biases_[j]  = 0;
+    touched_[j] = false;
+    model_updated = true;
+  }
+  return model_updated;
+}
@@ -0,0 +1,58 @@
+// Header for sparse gradient accumulation
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include <vector>
+
+#include "model.h"
+#include "common.h"
+#include "sparse_vector.h"
+#include "sparse_vector_view.h"
+
+
+// Sum of updates to the submodels of a model, used for mini-batches.
+// Updates are collected as (id, value) pairs and merged by id when the
+// gradient is applied, so each submodel is updated once per batch. Ids
+// are merged in linear time through a table of positions by feature or,
+// for sparse models, whose memory must not grow with the number of
+// features, by sorting the pairs by id.
+class Gradient
+{
+  public:
+    void Init (int num_submodels, int num_features,
+      bool sparse = false);           // Merge by sorting if sparse
+    void Add (int submodel, float scalar, const SparseVectorView &instance);
+    bool ApplyTo (Model &model);      // Add to model, clear, return true
+                                      // if model was changed
+  private:
+    std::vector<std::vector<SparseVector::elem_t> > elems_; // Per submodel
+    std::vector<float> biases_;       // Bias update per submodel
+    std::vector<char>  touched_;      // Submodel has an update
+    std::vector<int>   positions_;    // Position of id in merged update
+                                      // or -1, empty if sparse
+    std::vector<id_t>  merged_ids_;   // Merged update of one submodel
+    std::vector<float> merged_values_;
+};
+
+#endif
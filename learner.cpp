@@ -23,12 +23,20 @@
 #include <cmath>
 #include <cstdio>
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 #include <boost/program_options.hpp>
 #include "tiny_log.h"
 
 #include "learner.h"
+#include "sparse_kernels.h"
+#include "text_writer.h"
 
 
 namespace po = boost::program_options;
@@ -47,20 +55,126 @@ std::istream& operator>> (std::istream& in, Learner::RegType& reg_type)
 }
 
 
+std::istream& operator>> (std::istream& in, DataSet::Layout& layout)
+{
+  std::string token;
+  in >> token;
+  if (token == "vectors")
+    layout = DataSet::kLayoutVectors;
+  else if (token == "csr")
+    layout = DataSet::kLayoutCSR;
+  return in;
+}
+
+
+std::istream& operator>> (std::istream& in, Sampler::Policy& policy)
+{
+  std::string token;
+  in >> token;
+  if (token == "uniform")
+    policy = Sampler::kSampleUniform;
+  else if (token == "permutation")
+    policy = Sampler::kSamplePermutation;
+  else if (token == "sequential")
+    policy = Sampler::kSampleSequential;
+  return in;
+}
+
+
+std::istream& operator>> (std::istream& in, Model::Format& format)
+{
+  std::string token;
+  in >> token;
+  if (token == "text")
+    format = Model::kFormatText;
+  else if (token == "binary")
+    format = Model::kFormatBinary;
+  return in;
+}
+
+
+std::istream& operator>> (std::istream& in, Model::Layout& layout)
+{
+  std::string token;
+  in >> token;
+  if (token == "separate")
+    layout = Model::kLayoutSeparate;
+  else if (token == "interleaved")
+    layout = Model::kLayoutInterleaved;
+  else if (token == "sparse")
+    layout = Model::kLayoutSparse;
+  return in;
+}
+
+
+std::istream& operator>> (std::istream& in,
+  WeightVector::Precision& precision)
+{
+  std::string token;
+  in >> token;
+  if (token == "float")
+    precision = WeightVector::kFloat32;
+  else if (token == "bf16")
+    precision = WeightVector::kBFloat16;
+  else if (token == "fp16")
+    precision = WeightVector::kFloat16;
+  return in;
+}
+
+
+std::istream& operator>> (std::istream& in, KernelSet& kernels)
+{
+  std::string token;
+  in >> token;
+  if (token == "auto")
+    kernels = kKernelsAuto;
+  else if (token == "scalar")
+    kernels = kKernelsScalar;
+  else if (token == "avx2")
+    kernels = kKernelsAVX2;
+  else if (token == "avx512")
+    kernels = kKernelsAVX512;
+  return in;
+}
+
+
 Learner::Learner ()
 : options_ ("Allowed options", po::options_description::m_default_line_length)
+, result_(0)
 {
   // Add options
   po::options_description opt_general ("General options");
   opt_general.add_options ()
     ("help,h", "display this help message")
+    ("hash-bits", po::value<int> (&hash_bits_)->default_value (0),
+      "hash feature names into 2^arg ids, names may be strings")
+    ("batch-size",
+      po::value<int> (&batch_size_)->default_value (1),
+      "number of instances per update (mini-batch)")
     ("eval,e",
       po::value<bool> (&evaluate_)->zero_tokens ()->default_value (false),
       "evaluate on data")
+    ("eval-threads",
+      po::value<int> (&eval_threads_)->default_value (1),
+      "number of threads for evaluation")
     ("input-file", po::value<std::string> (&data_in_), "name of data file")
+    ("data-layout", po::value<DataSet::Layout> (&data_layout_)
+      ->default_value (DataSet::kLayoutCSR, "csr"),
+      "storage layout of data set (vectors | csr)")
+    ("data-cache", po::value<std::string> (&data_cache_)->default_value (""),
+      "map binary cache of data file, write it if missing or outdated")
+    ("early-stopping",
+      po::value<int> (&early_stopping_)->default_value (0),
+      "stop learning after arg validations without improvement")
+    ("epochs", po::value<int> (&num_epochs_)->default_value (0),
+      "number of passes over the training data, overrides num-iterations"
+      " and num-passes")
     ("learn,l",
       po::value<bool> (&learn_)->zero_tokens ()->default_value (false),
       "learn from data")
+    ("load-threads",
+      po::value<int> (&load_threads_)->default_value (1),
+      "number of threads for reading data")
     ("lr", po::value<float> (&initial_learning_rate_)->default_value (0.02),
       "learning rate")
     ("decreasing-lr",
@@ -73,10 +187,35 @@ Learner::Learner ()
     ("model-out",
       po::value<std::string> (&model_out_)->default_value (""),
       "write final model to file")
+    ("model-format", po::value<Model::Format> (&model_format_)
+      ->default_value (Model::kFormatText, "text"),
+      "format of written models (text | binary)")
+    ("model-layout", po::value<Model::Layout> (&model_layout_)
+      ->default_value (Model::kLayoutSeparate, "separate"),
+      "storage of submodel weights (separate | interleaved | sparse)")
+    ("weight-precision",
+      po::value<WeightVector::Precision> (&weight_precision_)
+      ->default_value (WeightVector::kFloat32, "float"),
+      "format of stored weights (float | bf16 | fp16), fp16 weights beyond"
+      " about +-256 are clamped")
     ("intermediate-models",
       po::value<bool> (&write_intermediate_models_)->zero_tokens()
         ->default_value (false),
-      "write model at each update")
+      "write model-out.iteration after updates, in the background")
+    ("snapshot",
+      po::value<int> (&snapshot_)->default_value (-1),
+      "snapshot to read if model-in is a delta stream, -1 for the last")
+    ("snapshot-deltas",
+      po::value<bool> (&snapshot_deltas_)->zero_tokens ()
+        ->default_value (false),
+      "append changed weights of intermediate models to"
+      " model-out.snapshots")
+    ("snapshot-interval",
+      po::value<int> (&snapshot_interval_)->default_value (1),
+      "minimum number of updates between intermediate models")
+    ("snapshot-seconds",
+      po::value<float> (&snapshot_seconds_)->default_value (0),
+      "minimum number of seconds between intermediate models")
     ("num-features,f",
       po::value<int> (&num_features_)->default_value(1, "input-file"),
       "number of features")
@@ -85,6 +224,8 @@ Learner::Learner ()
       "number of iterations")
     ("num-instances,n", po::value<int> (&num_instances_)->default_value (0),
       "hint about number of instances in data")
+    ("num-passes", po::value<int> (&num_passes_)->default_value (1),
+      "number of passes over data file when streaming")
     ("pegasos-projection",
       po::value<bool> (&pegasos_projection_)->zero_tokens ()
         ->default_value (false), "use pegasos style L2-ball projection")
@@ -107,6 +248,34 @@ Learner::Learner ()
     ("reg-type,t", po::value<Learner::RegType> (&reg_type_)
       ->default_value (Learner::kRegL2, "l2"),
       "regularization type (none | l1 | l2)")
+    ("sampling", po::value<Sampler::Policy> (&sampling_)
+      ->default_value (Sampler::kSampleUniform, "uniform"),
+      "instance sampling (uniform | permutation | sequential)")
+    ("shuffle-buffer",
+      po::value<int> (&shuffle_buffer_)->default_value (0),
+      "draw streamed instances at random from a buffer of arg instances")
+    ("simd", po::value<KernelSet> (&kernels_)
+      ->default_value (kKernelsAuto, "auto"),
+      "instruction set of sparse kernels (auto | scalar | avx2 | avx512)")
+    ("stream",
+      po::value<bool> (&stream_)->zero_tokens ()->default_value (false),
+      "stream data from file instead of loading it, requires num-features"
+      " and ignores num-iterations")
+    ("stream-buffer",
+      po::value<int> (&stream_buffer_)->default_value (65536),
+      "number of instances read ahead when streaming")
+    ("threads",
+      po::value<int> (&num_threads_)->default_value (1),
+      "number of threads for lock-free (Hogwild!) learning")
+    ("validation-file",
+      po::value<std::string> (&validation_in_)->default_value (""),
+      "validate on data file during learning and keep the best model")
+    ("validation-interval",
+      po::value<int> (&validation_interval_)->default_value (0, "epoch"),
+      "number of iterations between validations")
+    ("validation-split",
+      po::value<float> (&validation_split_)->default_value (0),
+      "validate on this fraction of instances at the end of input-file")
     ("verbosity", po::value<int> (), "verbosity level (0 ... 7)")
   ;
   options_.add (opt_general);
@@ -138,36 +307,272 @@ int Learner::Init (int argc, char ** argv)
 
 int Learner::Run ()
 {
-  // Initialize random number generator
-  srand (random_seed_); 
+  if (!SelectKernels (kernels_))
+  {
+    FATAL << "SIMD kernels " << KernelSetName (kernels_)
+      << " are not supported by this CPU" << std::endl;
+    return 1;
+  }
+  INFO << "using " << KernelSetName (SelectedKernels ()) << " kernels"
+    << std::endl;
+  if (eval_threads_ < 1)
+    eval_threads_ = 1;
+
+  // With feature hashing, the number of features is fixed
+  if (hash_bits_ > 0)
+  {
+    if (hash_bits_ > kMaxHashBits)
+    {
+      FATAL << "hash-bits must not exceed " << kMaxHashBits << std::endl;
+      return 1;
+    }
+    num_features_ = (1 << hash_bits_) + 1;
+  }
+
+  // Read data set, when streaming only needed for evaluation. Without
+  // learning and evaluation, models are only converted.
+  DataSet data_set (num_instances_, data_layout_, hash_bits_);
+  if (stream_ && learn_ && (num_features_ <= 1))
+  {
+    FATAL << "Streaming requires num-features" << std::endl;
+    return 1;
+  }
+  if (evaluate_ || (learn_ && !stream_))
+  {
+    if (stream_)
+      WARN << "Evaluation reads the whole data set into memory" << std::endl;
+    PROFILE_START (kRead);
+    if ((data_cache_ != "")
+      && data_set.ReadCache (data_cache_.c_str (), data_in_.c_str ()))
+    {
+      INFO << "mapped data cache (" << data_cache_ << ")" << std::endl;
+    }
+    else
+    {
+      INFO << "reading data (" << data_in_ << ") ..." << std::endl;
+      if (!data_set.Read (data_in_.c_str (), load_threads_))
+        return 1;
+      PROFILE_ADD (kBytesParsed, Profile::FileSize (data_in_.c_str ()));
+      if (data_cache_ != "")
+      {
+        INFO << "writing data cache (" << data_cache_ << ") ..." << std::endl;
+        data_set.WriteCache (data_cache_.c_str (), data_in_.c_str ());
+      }
+    }
+    PROFILE_STOP (kRead);
+    INFO << "read " << data_set.size () << " instances ("
+      << data_set.memory_usage () << " bytes)" << std::endl;
+    if (hash_bits_ > 0)
+      ReportHashCollisions (data_set);
+    id_t max_id = data_set.max_id ();
+    if (max_id >= id_t (INT_MAX))
+    {
+      FATAL << "Maximum id in '" << data_in_ << "' too large (" << max_id
+        << " >= " << INT_MAX << ")" << std::endl;
+      return 1;
+    }
+    if (max_id >= num_features_)
+    {
+      if (num_features_ != 0)
+        WARN << "Maximum id in '" << data_in_ 
+          << "' greater than num-features ("
+          << max_id << " >= " << num_features_ << ")" << std::endl;
+      num_features_ = max_id + 1;
+    }
+  }
 
-  // Read data set
-  DataSet data_set (num_instances_);
-  INFO << "reading data (" << data_in_ << ") ..." << std::endl;
-  id_t max_id = data_set.Read (data_in_.c_str ());
-  if (max_id >= num_features_)
+  // Validation data is a separate file or the end of the data set
+  DataSet validation_set (0, data_layout_, hash_bits_);
+  num_train_ = data_set.size ();
+  validation_set_ = NULL;
+  if (learn_ && (validation_in_ != ""))
   {
-    if (num_features_ != 0)
-      WARN << "Maximum id in '" << data_in_ << "' greater than num-features ("
-        << max_id << " >= " << num_features_ << ")" << std::endl;
-    num_features_ = max_id + 1;
+    INFO << "reading validation data (" << validation_in_ << ") ..."
+      << std::endl;
+    PROFILE_START (kRead);
+    if (!validation_set.Read (validation_in_.c_str (), load_threads_))
+      return 1;
+    PROFILE_STOP (kRead);
+    PROFILE_ADD (kBytesParsed, Profile::FileSize (validation_in_.c_str ()));
+    if (validation_set.max_id () >= id_t (INT_MAX))
+    {
+      FATAL << "Maximum id in '" << validation_in_ << "' too large ("
+        << validation_set.max_id () << " >= " << INT_MAX << ")" << std::endl;
+      return 1;
+    }
+    validation_set_   = &validation_set;
+    validation_begin_ = 0;
+    num_features_ = std::max (num_features_, 
+      int (validation_set.max_id ()) + 1);
+  }
+  else if (learn_ && (validation_split_ > 0))
+  {
+    if (stream_)
+    {
+      FATAL << "validation-split requires loading the data set" << std::endl;
+      return 1;
+    }
+    num_train_ = data_set.size () 
+      - size_t (validation_split_ * data_set.size ());
+    validation_set_   = &data_set;
+    validation_begin_ = num_train_;
+  }
+  if (validation_set_ 
+    && ((!stream_ && (num_train_ == 0))
+      || (validation_begin_ >= validation_set_->size ())))
+  {
+    FATAL << "Training or validation set is empty" << std::endl;
+    return 1;
   }
 
-  // Initialize model
-  model_.Init (num_submodels_, num_features_);
-  if (model_in_ != "")
+  // Initialize model, binary models with separate weights are mapped if
+  // not learning
+  PROFILE_START (kModel);
+  if (!learn_ && (model_in_ != "")
+    && (model_layout_ == Model::kLayoutSeparate)
+    && model_.Map (model_in_.c_str (), num_submodels_, num_features_))
+  {
+    INFO << "mapped model (" << model_in_ << ")" << std::endl;
+  }
+  else
   {
-    INFO << "reading model (" << model_in_ << ") ..." << std::endl;
-    model_.Read (model_in_.c_str ());
+    if ((weight_precision_ != WeightVector::kFloat32)
+      && (model_layout_ != Model::kLayoutSeparate))
+    {
+      WARN << "16 bit weights need the separate model layout" << std::endl;
+      weight_precision_ = WeightVector::kFloat32;
+    }
+    model_.Init (num_submodels_, num_features_, model_layout_,
+      weight_precision_);
+    if (model_in_ != "")
+    {
+      INFO << "reading model (" << model_in_ << ") ..." << std::endl;
+      model_.Read (model_in_.c_str (), snapshot_);
+    }
   }
+  PROFILE_STOP (kModel);
 
   // Learn
   if (learn_)
   {
     INFO << "learning ..." << std::endl;
-    Learn (data_set);
+    if (batch_size_ < 1)
+    {
+      FATAL << "batch-size must be at least 1" << std::endl;
+      return 1;
+    }
+    if ((batch_size_ > 1) && (num_threads_ > 1) && !stream_)
+    {
+      WARN << "Mini-batches are not supported with threads" << std::endl;
+      batch_size_ = 1;
+    }
+    if ((num_threads_ > 1) && (model_layout_ == Model::kLayoutSparse))
+    {
+      WARN << "Hogwild! is not supported with sparse models" << std::endl;
+      num_threads_ = 1;
+    }
+    if ((num_threads_ > 1) && validation_set_)
+    {
+      WARN << "Hogwild! is not supported with validation" << std::endl;
+      num_threads_ = 1;
+    }
+    if ((num_threads_ > 1) && write_intermediate_models_ && snapshot_deltas_)
+    {
+      WARN << "Hogwild! is not supported with snapshot deltas" << std::endl;
+      num_threads_ = 1;
+    }
+    if ((num_threads_ > 1) && (weight_precision_ != WeightVector::kFloat32))
+    {
+      // One random engine per submodel rounds the updates of all threads
+      WARN << "Hogwild! is not supported with 16 bit weights" << std::endl;
+      num_threads_ = 1;
+    }
+
+    // An epoch is one pass over the training instances
+    int epoch_iterations = std::max (int (num_train_) / batch_size_, 1);
+    if (num_epochs_ > 0)
+    {
+      if (stream_)
+        num_passes_ = num_epochs_;
+      else
+      {
+        int64_t iterations = int64_t (num_epochs_) * epoch_iterations;
+        if (iterations > INT_MAX)
+        {
+          FATAL << "epochs give too many iterations (" << iterations
+            << " > " << INT_MAX << ")" << std::endl;
+          return 1;
+        }
+        num_iterations_ = iterations;
+      }
+    }
+    if (validation_set_ && (validation_interval_ <= 0))
+    {
+      if (stream_)
+      {
+        FATAL << "Validation when streaming requires validation-interval"
+          << std::endl;
+        return 1;
+      }
+      validation_interval_ = epoch_iterations;
+    }
+    best_result_     = -1;
+    best_iteration_  = -1;
+    num_worse_       = 0;
+    last_iteration_  = -1;
+    last_validation_ = -1;
+
+    // Snapshots are written by a background thread from two buffers, the
+    // writer writes queued snapshots when it is destroyed
+    std::unique_ptr<SnapshotWriter> snapshot_writer;
+    if (write_intermediate_models_)
+      snapshot_writer.reset (new SnapshotWriter (model_out_, model_format_,
+        snapshot_deltas_, 2));
+    snapshot_writer_ = snapshot_writer.get ();
+    snapshot_updates_ = 0;
+    last_snapshot_    = std::chrono::steady_clock::now ();
+
+    PROFILE_START (kLearn);
+    if (batch_size_ > 1)
+      gradient_.Init (model_.num_submodels (), model_.num_features (),
+        model_layout_ == Model::kLayoutSparse);
+    if (stream_)
+    {
+      DataStream stream (num_passes_, stream_buffer_, shuffle_buffer_,
+        num_features_ - 1, random_seed_, hash_bits_);
+      if (!stream.Open (data_in_.c_str ()) || !LearnStream (stream))
+        return 1;
+      PROFILE_ADD (kBytesStreamed, 
+        Profile::FileSize (data_in_.c_str ()) * num_passes_);
+    }
+    else if (num_threads_ > 1)
+      LearnParallel (data_set);
+    else
+      Learn (data_set);
+    if (validation_set_)
+      FinishValidation ();
+    PROFILE_STOP (kLearn);
+    if (snapshot_writer)
+    {
+      if (snapshot_writer->num_waits ())
+        INFO << snapshot_writer->num_waits ()
+          << " snapshots found the writer busy" << std::endl;
+      PROFILE_START (kIntermediate);
+      snapshot_writer.reset ();
+      snapshot_writer_ = NULL;
+      PROFILE_STOP (kIntermediate);
+    }
+    INFO << "model uses " << model_.memory_usage () << " bytes" << std::endl;
   }
 
+  // Out of range fp16 weights were clamped when stored, warn once per run
+  size_t num_clamped = 0;
+  for (int j = 0; j < model_.num_submodels (); ++j)
+    num_clamped += model_[j].num_clamped ();
+  if (num_clamped > 0)
+    WARN << num_clamped << " fp16 weights were clamped to +-"
+      << WeightVector::kMaxFloat16 << " times the scale" << std::endl;
+
   // Evaluate
   if (evaluate_)
   {
@@ -179,75 +584,538 @@ int Learner::Run ()
   if (model_out_ != "")
   {
     INFO << "writing model (" << model_out_ << ") ..." << std::endl;
-    model_.Write (model_out_.c_str ());
+    PROFILE_START (kWrite);
+    model_.Write (model_out_.c_str (), model_format_);
+    PROFILE_STOP (kWrite);
   }
 
+#ifdef SOL_PROFILE
+  INFO << "profile: " << profile_.Summary () << std::endl;
+#endif
+
   return 0;
 }
 
 
 void Learner::Learn (const DataSet &data_set)
 {
+  Sampler sampler (sampling_, num_train_, random_seed_);
+  std::vector<SparseVectorView> batch;
   for (int i = 0; i < num_iterations_; ++i)
   {
-    // Setup learning rate
-    if (decreasing_lr_)
-      learning_rate_ = initial_learning_rate_/(1.0 + reg_param_ * float(i));
+    if (batch_size_ > 1)
+    {
+      batch.clear ();
+      for (int b = 0; b < batch_size_; ++b)
+        batch.push_back (data_set[sampler.Next ()]);
+      IterateBatch (batch, i);
+    }
     else
-      learning_rate_ = initial_learning_rate_;
+      Iterate (data_set[sampler.Next ()], i);
 
-    // Update from loss
-    bool model_updated = SingleUpdate (data_set);
+    // report progress
+    if ((progress_interval_ > 0) &&  (i % progress_interval_) == 0)
+      INFO << i << '/' << num_iterations_ << '\r';
+    if (!ContinueLearning (i))
+      break;
+  }
+}
+
+
+// Learn from all instances of the stream, return false on read errors
+bool Learner::LearnStream (DataStream &stream)
+{
+  if (batch_size_ > 1)
+    return LearnStreamBatches (stream);
+  SparseVector instance;
+  for (int64_t i = 0; stream.Next (instance); ++i)
+  {
+    Iterate (instance, i);
 
-    // Update from regularization
-    if (i % reg_interval_ == 0)
+    // report progress
+    if ((progress_interval_ > 0) &&  (i % progress_interval_) == 0)
+      INFO << i << '\r';
+    if (!ContinueLearning (i))
+      break;
+  }
+  return !stream.failed ();
+}
+
+
+// Learn from mini-batches of consecutive stream instances
+bool Learner::LearnStreamBatches (DataStream &stream)
+{
+  std::vector<SparseVector> instances (batch_size_);
+  std::vector<SparseVectorView> batch;
+  for (int64_t i = 0; ; ++i)
+  {
+    batch.clear ();
+    while ((int (batch.size ()) < batch_size_)
+      && stream.Next (instances[batch.size ()]))
+      batch.push_back (instances[batch.size ()]);
+    if (batch.empty ())
+      break;
+    IterateBatch (batch, i);
+
+    // report progress
+    if ((progress_interval_ > 0) &&  (i % progress_interval_) == 0)
+      INFO << i << '\r';
+    if (!ContinueLearning (i))
+      break;
+  }
+  return !stream.failed ();
+}
+
+
+// Lock-free parallel SGD in the style of Hogwild!. Threads update the
+// shared model without locks, each drawing instances with its own
+// sampler. Operations on whole submodels, i.e. regularization,
+// pegasos projection and intermediate models, are applied by thread 0
+// between rounds of reg_interval_ iterations while all others wait, so
+// WeightVector's scale_ never changes during concurrent updates.
+void Learner::LearnParallel (const DataSet &data_set)
+{
+  std::vector<std::thread> threads;
+  std::vector<char> updated (num_threads_, false); // Updates in round
+  std::vector<size_t> num_updates (num_threads_, 0); // Updates per thread
+  Barrier barrier (num_threads_);
+  for (int t = 0; t < num_threads_; ++t)
+    threads.push_back (std::thread (&Learner::LearnWorker, this,
+      std::cref (data_set), t, std::ref (barrier), std::ref (updated),
+      std::ref (num_updates)));
+  for (int t = 0; t < num_threads_; ++t)
+  {
+    threads[t].join ();
+    PROFILE_ADD (kUpdates, num_updates[t]);
+  }
+  PROFILE_ADD (kIterations, num_iterations_);
+}
+
+
+// Number of updates in the last round of Hogwild!, at least 1 if the model
+// was changed by regularization only. counted is the total of all rounds.
+static size_t RoundUpdates (const std::vector<char> &updated,
+  const std::vector<size_t> &num_updates, size_t &counted)
+{
+  bool model_updated = false;
+  size_t total = 0;
+  for (size_t t = 0; t < updated.size (); ++t)
+  {
+    model_updated = model_updated || updated[t];
+    total += num_updates[t];
+  }
+  size_t round = total - counted;
+  counted = total;
+  return model_updated ? std::max (round, size_t (1)) : 0;
+}
+
+
+void Learner::LearnWorker (const DataSet &data_set, int thread,
+  Barrier &barrier, std::vector<char> &updated,
+  std::vector<size_t> &num_updates)
+{
+  // Sequential sampling starts each thread at a different position
+  Sampler sampler (sampling_, num_train_, random_seed_ + thread,
+    num_train_ / num_threads_ * thread);
+  size_t counted = 0;                 // Updates seen by thread 0
+  for (int64_t begin = 0; begin < num_iterations_; begin += reg_interval_)
+  {
+    int64_t end = std::min<int64_t> (begin + reg_interval_, num_iterations_);
+
+    // Whole-model updates at the start of each round
+    if (thread == 0)
     {
-      switch (reg_type_)
+      size_t round_updates = RoundUpdates (updated, num_updates, counted);
+      if (write_intermediate_models_ && SnapshotDue (round_updates))
       {
-        // L1-regularization
-        case kRegL1: 
-          model_.RegularizeL1 (reg_param_ * learning_rate_);
-          model_updated = true;
-          break;
-
-        // L2-regularization
-        case kRegL2: 
-          model_.RegularizeL2 (reg_param_ * learning_rate_);
-          model_updated = true;
-          break;
-
-        // Unregularized
-        case kRegNone: 
-        default:
-          break;
+        PROFILE_START (kIntermediate);
+        WriteIntermediateModel (begin - 1);
+        PROFILE_STOP (kIntermediate);
       }
+      PROFILE_START (kRegularize);
+      bool round_updated = Regularize (LearningRate (begin));
+      if (pegasos_projection_)
+      {
+        // Concurrent updates of the norms may have been lost
+        for (int j = 0; j < model_.num_submodels (); ++j)
+          model_[j].ComputeSquaredL2Norm ();
+        round_updated = Project () || round_updated;
+      }
+      PROFILE_STOP (kRegularize);
+      updated.assign (num_threads_, false);
+      updated[0] = round_updated;
+      if (progress_interval_ > 0)
+        INFO << begin << '/' << num_iterations_ << '\r';
     }
+    barrier.Wait ();
 
-    // Update from pegasos ball projection
-    if (pegasos_projection_)
+    // Concurrent loss updates, timed by thread 0
+    if (thread == 0)
+      PROFILE_START (kLossUpdate);
+    bool round_updated = false;
+    for (int64_t i = begin + thread; i < end; i += num_threads_)
     {
-      for (int j = 0; j < model_.num_submodels (); ++j)
+      SparseVectorView instance = data_set[sampler.Next ()];
+      bool instance_updated = SingleUpdate (instance, LearningRate (i));
+      num_updates[thread] += instance_updated;
+      round_updated = instance_updated || round_updated;
+    }
+    if (thread == 0)
+      PROFILE_STOP (kLossUpdate);
+    updated[thread] = updated[thread] || round_updated;
+    barrier.Wait ();
+  }
+
+  // Snapshot after the last round
+  if ((thread == 0) && write_intermediate_models_
+    && SnapshotDue (RoundUpdates (updated, num_updates, counted)))
+    WriteIntermediateModel (num_iterations_ - 1);
+}
+
+
+// Single SGD step on instance
+void Learner::Iterate (const SparseVectorView &instance, int64_t iteration)
+{
+  float learning_rate = LearningRate (iteration);
+
+  // Update from loss
+  PROFILE_START (kLossUpdate);
+  bool model_updated = SingleUpdate (instance, learning_rate);
+  PROFILE_STOP (kLossUpdate);
+  PROFILE_ADD (kIterations, 1);
+  PROFILE_ADD (kUpdates, model_updated);
+  FinishIteration (model_updated, learning_rate, iteration);
+}
+
+
+// Mini-batch step. Losses of all instances are computed against the same
+// model and the averaged updates are applied at once.
+void Learner::IterateBatch (const std::vector<SparseVectorView> &batch,
+  int64_t iteration)
+{
+  float learning_rate = LearningRate (iteration);
+
+  // Update from losses
+  PROFILE_START (kLossUpdate);
+  for (size_t b = 0; b < batch.size (); ++b)
+    SingleUpdate (batch[b], learning_rate / batch.size ());
+  bool model_updated = gradient_.ApplyTo (model_);
+  PROFILE_STOP (kLossUpdate);
+  PROFILE_ADD (kIterations, 1);
+  PROFILE_ADD (kUpdates, model_updated);
+  FinishIteration (model_updated, learning_rate, iteration);
+}
+
+
+void Learner::FinishIteration (bool model_updated, float learning_rate,
+  int64_t iteration)
+{
+  // Update from regularization
+  PROFILE_START (kRegularize);
+  if (iteration % reg_interval_ == 0)
+    model_updated = Regularize (learning_rate) || model_updated;
+
+  // Update from pegasos ball projection
+  if (pegasos_projection_)
+    model_updated = Project () || model_updated;
+  PROFILE_STOP (kRegularize);
+
+  // Write intermediate models    
+  if (write_intermediate_models_ && SnapshotDue (model_updated))
+  {
+    PROFILE_START (kIntermediate);
+    WriteIntermediateModel (iteration);
+    PROFILE_STOP (kIntermediate);
+  }
+}
+
+
+// Add scalar * instance to the weights and scalar to the bias of
+// submodel. In mini-batch mode, the update is deferred to the end of the
+// batch.
+void Learner::Update (int submodel, float scalar,
+  const SparseVectorView &instance)
+{
+  if (batch_size_ > 1)
+  {
+    gradient_.Add (submodel, scalar, instance);
+    return;
+  }
+  model_[submodel].PlusEquals (scalar, instance);
+  model_[submodel].set_bias (model_[submodel].bias () + scalar);
+}
+
+
+float Learner::LearningRate (int64_t iteration) const
+{
+  if (decreasing_lr_)
+    return initial_learning_rate_ / (1.0 + reg_param_ * float (iteration));
+  else
+    return initial_learning_rate_;
+}
+
+
+// Log how many of the 2^hash_bits_ ids are used by the data set and
+// estimate the number of distinct features and collisions from the
+// fraction of unused ids (linear counting).
+void Learner::ReportHashCollisions (const DataSet &data_set) const
+{
+  size_t num_ids = size_t (1) << hash_bits_;
+  size_t num_used = 0;
+  std::vector<bool> used (num_ids + 1, false);
+  for (size_t i = 0; i < data_set.size (); ++i)
+  {
+    SparseVectorView instance = data_set[i];
+    for (int k = 0; k < instance.size (); ++k)
+    {
+      if (!used[instance.id (k)])
       {
-        float factor = 1.0/(sqrt (reg_param_) * model_[0].squaredL2Norm ());
-        if (factor < 1.0)
-        {
-          model_[j].Scale (factor);
-          model_updated = true;
-        }
+        used[instance.id (k)] = true;
+        ++num_used;
       }
     }
+  }
+  if (num_used == num_ids)
+  {
+    WARN << "hashing: all " << num_ids << " ids used, increase hash-bits"
+      << std::endl;
+    return;
+  }
+  double features = - double (num_ids) 
+    * log (1.0 - double (num_used) / num_ids);
+  INFO << "hashing: " << num_used << " of " << num_ids << " ids used, about "
+    << size_t (features + 0.5) << " features and "
+    << size_t (features - num_used + 0.5) << " collisions" << std::endl;
+}
 
-    // Write intermediate models    
-    if (write_intermediate_models_ && model_updated)
+
+float Learner::result () const
+{
+  return result_;
+}
+
+
+// Evaluate model on data set
+void Learner::Evaluate (const DataSet &data_set)
+{
+  std::chrono::steady_clock::time_point start
+    = std::chrono::steady_clock::now ();
+  size_t count = data_set.size ();
+  std::vector<int> predictions (print_predictions_ ? count : 0);
+  PROFILE_START (kEvaluate);
+  size_t positive = CountPositive (data_set, 0, count, predictions);
+  PROFILE_STOP (kEvaluate);
+  PROFILE_ADD (kEvaluated, count);
+  double seconds = std::chrono::duration<double> (
+    std::chrono::steady_clock::now () - start).count ();
+
+  // Write predictions
+  if (print_predictions_)
+  {
+    TextWriter writer (std::cout);
+    for (size_t i = 0; i < count; ++i)
     {
-      const int kBufSize = 1000;
-      char buffer[kBufSize];
-      snprintf (buffer, kBufSize, "%s.%08x", model_out_.c_str (), i);
-      model_.Write (buffer);
+      writer.Put (predictions[i]);
+      writer.Put ('\n');
     }
+  }
+  float result = float (positive) / float (count);
+  result_ = result;
 
-    // report progress
-    if ((progress_interval_ > 0) &&  (i % progress_interval_) == 0)
-      INFO << i << '/' << num_iterations_ << '\r';
+  // Log result
+  INFO << "result: " << result
+    << " (" << positive << '/' << count << ')' << std::endl;
+  INFO << "evaluated " << count << " instances in " << seconds << "s ("
+    << count / seconds << " instances/s)" << std::endl;
+  
+  // Write result to stdout
+  if (print_result_)
+    std::cout << result << std::endl;
+}
+
+
+// Count correct predictions on the instances first ... last - 1 of data
+// set. Threads take batches of kEvalBatchSize consecutive instances, count
+// correct predictions locally and, if predictions is not empty, store them
+// by index, so they can be written in input order afterwards.
+size_t Learner::CountPositive (const DataSet &data_set, size_t first,
+  size_t last, std::vector<int> &predictions) const
+{
+  std::vector<size_t> positives (eval_threads_, 0);
+  std::atomic<size_t> next_batch (0);
+  if (eval_threads_ > 1)
+  {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < eval_threads_; ++t)
+      threads.push_back (std::thread (&Learner::EvaluateWorker, this,
+        std::cref (data_set), first, last, t, std::ref (next_batch), 
+        std::ref (positives[t]), std::ref (predictions)));
+    for (int t = 0; t < eval_threads_; ++t)
+      threads[t].join ();
+  }
+  else
+    EvaluateWorker (data_set, first, last, 0, next_batch, positives[0],
+      predictions);
+  size_t positive = 0;
+  for (int t = 0; t < eval_threads_; ++t)
+    positive += positives[t];
+  return positive;
+}
+
+
+void Learner::EvaluateWorker (const DataSet &data_set, size_t first,
+  size_t last, int thread, std::atomic<size_t> &next_batch,
+  size_t &positive, std::vector<int> &predictions) const
+{
+  const size_t kEvalBatchSize = 1024;
+  size_t count = last - first;
+  size_t local_positive = 0;
+  std::vector<float> scores (model_.num_submodels ());
+  for (size_t begin = next_batch++ * kEvalBatchSize; begin < count;
+    begin = next_batch++ * kEvalBatchSize)
+  {
+    size_t end = std::min (begin + kEvalBatchSize, count);
+    for (size_t i = begin; i < end; ++i)
+    {
+      int prediction;
+      if (Predict (data_set[first + i], scores.data (), prediction))
+        ++local_positive;
+      if (!predictions.empty ())
+        predictions[i] = prediction;
+    }
+
+    // Report progress if batch contains a multiple of progress_interval_
+    size_t interval = progress_interval_;
+    if ((thread == 0) && (interval > 0)
+      && ((begin + interval - 1) / interval * interval < end))
+      INFO << end << '/' << count << '\r';
+  }
+  positive = local_positive;
+}
+
+
+// Apply regularization, return true if the model was changed
+bool Learner::Regularize (float learning_rate)
+{
+  switch (reg_type_)
+  {
+    // L1-regularization
+    case kRegL1: 
+      model_.RegularizeL1 (reg_param_ * learning_rate);
+      return true;
+
+    // L2-regularization
+    case kRegL2: 
+      model_.RegularizeL2 (reg_param_ * learning_rate);
+      return true;
+
+    // Unregularized
+    case kRegNone: 
+    default:
+      return false;
+  }
+}
+
+
+// Project each submodel onto the pegasos L2-ball of radius
+// 1/sqrt(reg_param_), return true if the model was changed. The cached
+// norms make this O(1) per submodel.
+bool Learner::Project ()
+{
+  bool model_updated = false;
+  for (int j = 0; j < model_.num_submodels (); ++j)
+  {
+    float factor = 1.0 / sqrt (reg_param_ * model_[j].squaredL2Norm ());
+    if (factor < 1.0)
+    {
+      model_[j].Scale (factor);
+      model_updated = true;
+    }
+  }
+  return model_updated;
+}
+
+
+// Count num_updates model updates, return true if a snapshot is due: after
+// snapshot_interval_ updates and at least snapshot_seconds_ seconds since
+// the last snapshot
+bool Learner::SnapshotDue (size_t num_updates)
+{
+  snapshot_updates_ += num_updates;
+  if ((snapshot_updates_ == 0)
+    || (snapshot_updates_ < size_t (snapshot_interval_)))
+    return false;
+  return (snapshot_seconds_ <= 0) || (std::chrono::duration<double> (
+    std::chrono::steady_clock::now () - last_snapshot_).count ()
+    >= snapshot_seconds_);
+}
+
+
+// Queue a copy of the model, which is written to model_out_.iteration in
+// the background. Timed snapshots are skipped while the writer is busy,
+// so learning never waits for them.
+void Learner::WriteIntermediateModel (int64_t iteration)
+{
+  if (!snapshot_writer_->Capture (model_, iteration, snapshot_seconds_ <= 0))
+    return;
+  snapshot_updates_ = 0;
+  last_snapshot_    = std::chrono::steady_clock::now ();
+}
+
+
+// Validate after every validation_interval_ iterations, return false if
+// learning should stop early
+bool Learner::ContinueLearning (int64_t iteration)
+{
+  last_iteration_ = iteration;
+  if (!validation_set_ || ((iteration + 1) % validation_interval_ != 0))
+    return true;
+  return Validate (iteration);
+}
+
+
+// Score the model on the validation instances. Improved models become the
+// checkpoint, so only weights changed afterwards are saved. Return false
+// after early_stopping_ validations without improvement.
+bool Learner::Validate (int64_t iteration)
+{
+  std::vector<int> predictions;
+  size_t last = validation_set_->size ();
+  PROFILE_START (kValidate);
+  size_t positive = CountPositive (*validation_set_, validation_begin_, last,
+    predictions);
+  PROFILE_STOP (kValidate);
+  float result = float (positive) / float (last - validation_begin_);
+  last_validation_ = iteration;
+  if (result > best_result_)
+  {
+    best_result_    = result;
+    best_iteration_ = iteration;
+    num_worse_      = 0;
+    model_.Checkpoint ();
+  }
+  else
+    ++num_worse_;
+  INFO << "validation after " << iteration + 1 << " iterations: " << result
+    << " (best " << best_result_ << " after " << best_iteration_ + 1 << ")"
+    << std::endl;
+  return (early_stopping_ <= 0) || (num_worse_ < early_stopping_);
+}
+
+
+// Validate the final model if necessary and return to the best model
+void Learner::FinishValidation ()
+{
+  if (last_iteration_ < 0)
+    return;
+  if (last_validation_ != last_iteration_)
+    Validate (last_iteration_);
+  if (best_iteration_ != last_iteration_)
+  {
+    INFO << "restoring model after " << best_iteration_ + 1 
+      << " iterations" << std::endl;
+    model_.RestoreCheckpoint ();
   }
+  else
+    model_.ReleaseCheckpoint ();
 }
@@ -23,26 +23,72 @@
 #ifndef LEARNER_H
 #define LEARNER_H
 
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <vector>
+
+#include <stdint.h>
 
 #include <boost/program_options.hpp>
 
+#include "barrier.h"
 #include "data_set.h"
+#include "data_stream.h"
+#include "gradient.h"
 #include "model.h"
+#include "profile.h"
+#include "sampler.h"
+#include "snapshot_writer.h"
+#include "sparse_kernels.h"
+#include "sparse_vector_view.h"
 
 
 class Learner
 {
   public:
+    static const int kMaxHashBits = 30; // Maximum of hash_bits_
     typedef enum { kRegNone, kRegL1, kRegL2 } RegType; // Regulatization type
     Learner ();                       // Constructor
     int Init (int argc, char **argv); // Initialize options
     int Run ();                       // Run learning process
+    float result () const;            // Result of last evaluation
   private:
     void Learn (const DataSet &data_set);                    // SGD loop
-    virtual bool SingleUpdate (const DataSet &data_set) = 0; // Loss-update
-    virtual void Evaluate (const DataSet &data_set) = 0;     // Evaluation
+    void LearnParallel (const DataSet &data_set);            // Hogwild! SGD
+    void LearnWorker (const DataSet &data_set, int thread, Barrier &barrier,
+      std::vector<char> &updated,
+      std::vector<size_t> &num_updates);                     // Hogwild! thread
+    bool LearnStream (DataStream &stream);                   // SGD on stream
+    bool LearnStreamBatches (DataStream &stream);            // Batches
+    void Iterate (const SparseVectorView &instance,
+      int64_t iteration);                                    // Step
+    void IterateBatch (const std::vector<SparseVectorView> &batch,
+      int64_t iteration);                                    // Batch step
+    void FinishIteration (bool model_updated, float learning_rate,
+      int64_t iteration);                          // Regularize, project
+    float LearningRate (int64_t iteration) const;  // Learning rate schedule
+    bool  Regularize (float learning_rate);        // Regularization update
+    bool  Project ();                              // Pegasos projection
+    bool  SnapshotDue (size_t num_updates);        // Snapshot policy
+    void  WriteIntermediateModel (int64_t iteration); // Queue snapshot
+    bool  ContinueLearning (int64_t iteration);    // Validate when due
+    bool  Validate (int64_t iteration);            // Keep best model
+    void  FinishValidation ();                     // Restore best model
+    void ReportHashCollisions (const DataSet &data_set) const; // Log stats
+    void Evaluate (const DataSet &data_set);                 // Evaluation
+    size_t CountPositive (const DataSet &data_set, size_t first,
+      size_t last, std::vector<int> &predictions) const;     // Correct ones
+    void EvaluateWorker (const DataSet &data_set, size_t first, size_t last,
+      int thread, std::atomic<size_t> &next_batch, size_t &positive,
+      std::vector<int> &predictions) const;                  // Eval thread
+    virtual bool SingleUpdate (const SparseVectorView &instance,
+      float learning_rate) = 0;                              // Loss-update
+    virtual bool Predict (const SparseVectorView &instance, float *scores,
+      int &prediction) const = 0;                  // Return true if correct
   protected:
+    void Update (int submodel, float scalar,
+      const SparseVectorView &instance);           // Add scalar * instance
     boost::program_options::options_description options_;    // Program options
     Model model_;                     // Learning model
     bool  learn_;                     // Learn model on input data
@@ -51,12 +97,28 @@ class Learner
     bool  print_predictions_;         // Print predictions to std::cout
     bool  pegasos_projection_;        // Use pegasos L2-ball projection
     std::string data_in_;             // Read data from file
+    DataSet::Layout data_layout_;     // Storage layout of data set
+    std::string data_cache_;          // Binary cache of data file
+    int   load_threads_;              // Number of threads for reading data
+    bool  stream_;                    // Stream data instead of loading it
+    int   num_passes_;                // Passes over data file (streaming)
+    int   stream_buffer_;             // Instances buffered (streaming)
+    int   shuffle_buffer_;            // Size of shuffle buffer (streaming)
     std::string model_in_;            // Read an initial model from file
     std::string model_out_;           // Write model to file
+    Model::Format model_format_;      // File format of written models
+    Model::Layout model_layout_;      // Storage layout of model weights
+    WeightVector::Precision weight_precision_; // Format of stored weights
     bool  write_intermediate_models_; // Write model at each iteration
+    bool  snapshot_deltas_;           // Write snapshots as delta stream
+    int   snapshot_;                  // Snapshot to read from delta stream
+    int   snapshot_interval_;         // Minimum updates between snapshots
+    float snapshot_seconds_;          // Minimum seconds between snapshots
+    size_t snapshot_updates_;         // Updates since last snapshot
+    std::chrono::steady_clock::time_point last_snapshot_; // Its time
+    SnapshotWriter *snapshot_writer_; // Writes snapshots or NULL
     bool  decreasing_lr_;             // Use decreasing learning rate
     float initial_learning_rate_;     // Initial learning rate
-    float learning_rate_;             // Current learning rate
     float margin_;                    // Margin
     RegType reg_type_;                // Regularization type
     float reg_param_;                 // Regularization parameter
@@ -64,13 +126,42 @@ class Learner
     int   num_classes_;               // Number of classes (multi-class)
     int   num_labels_;                // Number of labels (multi-label)
     int   num_features_;              // Number of features
+    int   hash_bits_;                 // Hash features into 2^hash_bits_
     int   num_iterations_;            // Number of iterations
+    int   num_epochs_;                // Passes over the training data
+    size_t num_train_;                // Instances used for learning
+    std::string validation_in_;       // Read validation data from file
+    float validation_split_;          // Fraction of data for validation
+    int   validation_interval_;       // Iterations between validations
+    int   early_stopping_;            // Validations without improvement
+    const DataSet *validation_set_;   // Validation data or NULL
+    size_t validation_begin_;         // First validation instance
+    float best_result_;               // Best validation result
+    int64_t best_iteration_;          // Iteration of best model
+    int   num_worse_;                 // Validations since best model
+    int64_t last_iteration_;          // Last learning iteration
+    int64_t last_validation_;         // Iteration of last validation
     int   num_instances_;             // Number of instances in data set
     int   num_submodels_;             // Number of submodels
     int   progress_interval_;         // Updates between progress reports
+    int   num_threads_;               // Number of Hogwild! threads
+    int   batch_size_;                // Instances per mini-batch
+    Gradient gradient_;               // Updates of current mini-batch
+    int   eval_threads_;              // Number of evaluation threads
+    Sampler::Policy sampling_;        // Instance sampling policy
+    KernelSet kernels_;               // Instruction set of sparse kernels
     unsigned random_seed_;            // Random seed
+    Profile profile_;                 // Timers and counters (SOL_PROFILE)
+    float result_;                    // Result of last evaluation
 };
 
 std::istream& operator>> (std::istream& in, Learner::RegType& reg_type);
+std::istream& operator>> (std::istream& in, DataSet::Layout& layout);
+std::istream& operator>> (std::istream& in, Sampler::Policy& policy);
+std::istream& operator>> (std::istream& in, Model::Format& format);
+std::istream& operator>> (std::istream& in, Model::Layout& layout);
+std::istream& operator>> (std::istream& in,
+  WeightVector::Precision& precision);
+std::istream& operator>> (std::istream& in, KernelSet& kernels);
 
 #endif
@@ -31,6 +31,7 @@
 #include "data_set.h"
 #include "learner.h"
 #include "model.h"
+#include "sparse_vector_view.h"
 #include "weight_vector.h"
 
 namespace po = boost::program_options;
@@ -44,61 +45,30 @@ int BinaryLearner::Init (int argc, char **argv)
 }
 
 
-bool BinaryLearner::SingleUpdate (const DataSet &data_set)
+bool BinaryLearner::SingleUpdate (const SparseVectorView &instance,
+  float learning_rate)
 {
-  int   instance      = rand () % data_set.size ();
   float bias          = model_[0].bias (); 
-  float model_score   = model_[0].InnerProduct (data_set[instance]) + bias;
-  float target_value  = data_set[instance].target ();
+  float model_score   = model_[0].InnerProduct (instance) + bias;
+  float target_value  = instance.target ();
   float target_sign   = sign (target_value);
   bool  model_updated = false;
 
   // Update from loss 
   if (target_sign * model_score < margin_) 
   {
-    model_[0].PlusEquals (learning_rate_ * target_sign, data_set[instance]);
-    model_[0].set_bias (bias + learning_rate_ * target_sign);
+    Update (0, learning_rate * target_sign, instance);
     model_updated = true;
   }
   return model_updated;
 }
 
 
-void BinaryLearner::Evaluate (const DataSet &data_set)
+bool BinaryLearner::Predict (const SparseVectorView &instance, 
+  float *, int &prediction) const
 {
-  int positive = 0; // TODO: true and false positives/negatives
-  int negative = 0;
-  int count    = data_set.size ();
-
-  for (int i = 0; i < count; ++i)
-  {
-    // apply model
-    float model_score  = model_[0].InnerProduct (data_set[i])
-      + model_[0].bias ();
-    float target_value = data_set[i].target ();
-
-    // compare prediction with target
-    if ((model_score * target_value > 0) || (model_score == target_value))
-      positive++;
-    else 
-      negative++;
-
-    // print predictions
-    if (print_predictions_)
-      std::cout << sign (model_score) << std::endl;
-
-    // report progress
-    if ((progress_interval_ > 0) && (i % progress_interval_ == 0))
-      INFO << i << '/' << count << '\r';
-  }
-  float result = float (positive) / float (positive + negative);
-
-  // log result
-  INFO << "result: " << result
-    << " (" << positive << '/' << positive + negative << ')' << std::endl;
-  
-  // print result to stdout
-  if (print_result_)
-    std::cout << result << std::endl;
+  float model_score  = model_[0].InnerProduct (instance) + model_[0].bias ();
+  float target_value = instance.target ();
+  prediction = sign (model_score);
+  return (model_score * target_value > 0) || (model_score == target_value);
 }
-
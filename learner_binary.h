@@ -25,6 +25,7 @@
 
 #include "data_set.h"
 #include "learner.h"
+#include "sparse_vector_view.h"
 
 
 class BinaryLearner : public Learner
@@ -32,8 +33,10 @@ class BinaryLearner : public Learner
   public:
     int Init (int argc, char **argv);
   protected:
-    bool SingleUpdate (const DataSet &data_set);
-    void Evaluate (const DataSet &data_set);
+    bool SingleUpdate (const SparseVectorView &instance,
+      float learning_rate);
+    bool Predict (const SparseVectorView &instance, float *scores,
+      int &prediction) const;
 };
 
 #endif
@@ -24,12 +24,14 @@
 
 #include <iostream>
 #include <limits>
+#include <vector>
 
 #include <boost/program_options.hpp>
 #include "tiny_log.h"
 
 #include "data_set.h"
 #include "learner_multiclass.h"
+#include "sparse_vector_view.h"
 #include "weight_vector.h"
 
 namespace po = boost::program_options;
@@ -61,28 +63,31 @@ int MultiClassLearner::Init (int argc, char **argv)
 
 
 // Learn multi-class classifier
-bool MultiClassLearner::SingleUpdate (const DataSet &data_set)
+bool MultiClassLearner::SingleUpdate (const SparseVectorView &instance,
+  float learning_rate)
 {
-  int   index  = rand () % data_set.size ();
-  float target = data_set[index].target ();
+  // Scores of all classes, per thread for Hogwild! learning
+  static thread_local std::vector<float> scores;
+  scores.resize (model_.num_submodels ());
+  model_.InnerProducts (instance, scores.data ());
+
+  float target = instance.target ();
   float bias   = model_[target].bias ();
-  float score  = model_[target].InnerProduct (data_set[index]) + bias;
+  float score  = scores[target] + bias;
   bool  model_updated = false;
 
   // Find max margin violator
   int   max_class = target;
-  float max_bias  = 0;
   float max_score = - std::numeric_limits<float>::max ();
   for (int c = 0; c < model_.num_submodels (); ++c)
   {
     if (c != target)
     {
       float tmp_bias  = model_[c].bias ();
-      float tmp_score = model_[c].InnerProduct (data_set[index]) + tmp_bias;
+      float tmp_score = scores[c] + tmp_bias;
       if (max_score < tmp_score)
       {
         max_class = c;
-        max_bias  = tmp_bias;
         max_score = tmp_score;
       } 
     } 
@@ -91,10 +96,8 @@ bool MultiClassLearner::SingleUpdate (const DataSet &data_set)
   // Update from loss 
   if ((max_class != target) && (score - max_score < margin_))
   {
-    model_[target].PlusEquals (learning_rate_, data_set[index]);
-    model_[target].set_bias (bias + learning_rate_);
-    model_[max_class].PlusEquals (- learning_rate_, data_set[index]);
-    model_[max_class].set_bias (max_bias - learning_rate_);
+    Update (target, learning_rate, instance);
+    Update (max_class, - learning_rate, instance);
     model_updated = true;
   }
 
@@ -102,51 +105,22 @@ bool MultiClassLearner::SingleUpdate (const DataSet &data_set)
 }
 
 
-void MultiClassLearner::Evaluate (const DataSet &data_set)
+// Predict class with maximum score
+bool MultiClassLearner::Predict (const SparseVectorView &instance,
+  float *scores, int &prediction) const
 {
-  int positive = 0;
-  int negative = 0;
-  int count    = data_set.size ();
-
-  for (int i = 0; i < count; ++i)
-  {
-    // Apply model
-    float target_value = data_set[i].target ();
-    float model_score  = - std::numeric_limits<float>::max();
-    int   predicted_class = -1; 
+  float model_score = - std::numeric_limits<float>::max();
+  prediction = -1; 
   
-    for (int j = 0; j < model_.num_submodels (); ++j)
+  model_.InnerProducts (instance, scores);
+  for (int j = 0; j < model_.num_submodels (); ++j)
+  {
+    float tmp_score = scores[j] + model_[j].bias ();
+    if (tmp_score > model_score)
     {
-      float tmp_score = model_[j].InnerProduct (data_set[i]) + 
-        model_[j].bias ();
-      if (tmp_score > model_score)
-      {
-        model_score = tmp_score;
-        predicted_class = j;
-      }
+      model_score = tmp_score;
+      prediction  = j;
     }
-
-    // Compare prediction with target
-    if (predicted_class == target_value)
-      positive++;
-    else 
-      negative++;
-
-    // Write predictions
-    if (print_predictions_)
-      std::cout << predicted_class << std::endl;
-
-    // Report progress
-    if ((progress_interval_ > 0) && (i % progress_interval_ == 0))
-      INFO << i << '/' << count << '\r';
   }
-  float result = float (positive) / float (positive+negative);
-
-  // Log result
-  INFO << "result: " << result
-    << " (" << positive << '/' << positive+negative << ')' << std::endl;
-  
-  // Write result to stdout
-  if (print_result_)
-    std::cout << result << std::endl;
+  return prediction == instance.target ();
 }
@@ -25,6 +25,7 @@
 
 #include "data_set.h"
 #include "learner.h"
+#include "sparse_vector_view.h"
 
 
 class MultiClassLearner : public Learner
@@ -33,8 +34,10 @@ class MultiClassLearner : public Learner
     MultiClassLearner ();
     int Init (int argc, char **argv);
   private:
-    bool SingleUpdate (const DataSet &data_set);
-    void Evaluate (const DataSet &data_set);
+    bool SingleUpdate (const SparseVectorView &instance,
+      float learning_rate);
+    bool Predict (const SparseVectorView &instance, float *scores,
+      int &prediction) const;
 };
 
 #endif
@@ -21,13 +21,14 @@
 
 
 #include <iostream>
+#include <vector>
 
 #include <boost/program_options.hpp>
 #include "tiny_log.h"
 
 #include "learner_multilabel.h"
 #include "weight_vector.h"
-#include "sparse_vector.h"
+#include "sparse_vector_view.h"
 
 namespace po = boost::program_options;
 
@@ -59,24 +60,28 @@ int MultiLabelLearner::Init (int argc, char **argv)
 
 
 // Learn multi-label classifier
-bool MultiLabelLearner::SingleUpdate (const DataSet &data_set)
+bool MultiLabelLearner::SingleUpdate (const SparseVectorView &instance,
+  float learning_rate)
 {
-  int index  = rand () % data_set.size ();
-  int target = int (data_set[index].target ());
+  int target = int (instance.target ());
   bool model_updated = false;
 
+  // Scores of all labels, per thread for Hogwild! learning
+  static thread_local std::vector<float> scores;
+  scores.resize (model_.num_submodels ());
+  model_.InnerProducts (instance, scores.data ());
+
   // Update from loss 
   for (int j = 0; j < model_.num_submodels ();  ++j)
   {
     int   current_class = 1 << j;
     float target_sign   = (target & current_class)?1:-1;
     float bias          = model_[j].bias ();
-    float score         = model_[j].InnerProduct (data_set[index]) + bias;
+    float score         = scores[j] + bias;
 
     if (target_sign * score < 1)
     {
-      model_[j].PlusEquals (target_sign * learning_rate_, data_set[index]);
-      model_[j].set_bias (bias + learning_rate_ * target_sign);
+      Update (j, target_sign * learning_rate, instance);
       model_updated = true;
     }
   }
@@ -84,51 +89,20 @@ bool MultiLabelLearner::SingleUpdate (const DataSet &data_set)
 }
 
 
-// Evaluate multi-label classifier
-void MultiLabelLearner::Evaluate (const DataSet &data_set)
+// Predict labels as bits of the class number
+bool MultiLabelLearner::Predict (const SparseVectorView &instance,
+  float *scores, int &prediction) const
 {
-  int positive = 0;
-  int negative = 0;
-  int count    = data_set.size ();
-
-  for (int i = 0; i < count; ++i)
-  {
-    // Apply model
-    int predicted_class = 0; 
+  prediction = 0; 
   
-    for (int j = 0; j < model_.num_submodels (); ++j)
+  model_.InnerProducts (instance, scores);
+  for (int j = 0; j < model_.num_submodels (); ++j)
+  {
+    float tmp_score = scores[j] + model_[j].bias ();
+    if (tmp_score > 0)
     {
-      float tmp_score = model_[j].InnerProduct (data_set[i]) + 
-        model_[j].bias ();
-      if (tmp_score > 0)
-      {
-        predicted_class |= 1 << j;
-      }
+      prediction |= 1 << j;
     }
-
-    // Compare prediction with target
-    int target_value = int (data_set[i].target ());
-    if (predicted_class == target_value)
-      positive++;
-    else 
-      negative++;
-
-    // Write predictions
-    if (print_predictions_)
-      std::cout << predicted_class << std::endl;
-
-    // Report progress
-    if ((progress_interval_ > 0) && (i % progress_interval_ == 0))
-      INFO << i << '/' << count << '\r';
   }
-  float result = float (positive) / float (positive + negative);
-
-  // Log result
-  INFO << "result: " << result
-    << " (" << positive << '/' << positive + negative << ')' << std::endl;
-  
-  // Write result to stdout
-  if (print_result_)
-    std::cout << result << std::endl;
+  return prediction == int (instance.target ());
 }
-
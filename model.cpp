@@ -20,24 +20,262 @@
 // along with Sol.  If not, see <http://www.gnu.org/licenses/>.
 
 
+#include <climits>
+#include <cstring>
 #include <fstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "model.h"
+#include "model_delta.h"
 #include "sparse_data_format.h"
+#include "text_writer.h"
 #include "tiny_log.h"
 
 
-void Model::Init (int num_submodels, int num_features)
+// Binary model format. The header is followed by one block per submodel,
+// consisting of a SubmodelHeader and either num_features weights (dense)
+// or num_weights ids and num_weights values of the non-zero weights
+// (sparse). Dense blocks are padded so all blocks are 8 byte aligned.
+// Stored weights are multiplied by scale.
+const char     kModelMagic[8] = { 'S', 'O', 'L', 'M', 'O', 'D', 'E', 'L' };
+const uint32_t kModelVersion  = 1;
+
+struct ModelHeader
+{
+  char     magic[8];      // kModelMagic
+  uint32_t version;       // kModelVersion
+  uint32_t num_submodels; // Number of submodels
+  uint64_t num_features;  // Number of features
+};
+
+struct SubmodelHeader
+{
+  float    bias;          // Bias of submodel
+  float    scale;         // Scale of stored weights
+  uint32_t dense;         // 1 if block is dense, 0 if sparse
+  uint32_t reserved;      // Always 0
+  uint64_t num_weights;   // Number of stored weights
+};
+
+
+// Size of the block following a submodel header
+inline size_t block_size (const SubmodelHeader &submodel)
+{
+  if (submodel.dense)
+    return (submodel.num_weights * sizeof (float) + 7) & ~size_t (7);
+  return submodel.num_weights * (sizeof (id_t) + sizeof (float));
+}
+
+
+Model::Model ()
+: mapping_(NULL)
+, mapping_size_(0)
+{}
+
+
+Model::~Model ()
+{
+  submodels_.clear ();
+  if (mapping_)
+    munmap (mapping_, mapping_size_);
+}
+
+
+// Precision is ignored by the interleaved and sparse layouts
+void Model::Init (int num_submodels, int num_features, Layout layout,
+  WeightVector::Precision precision)
+{
+  if (layout != kLayoutInterleaved)
+  {
+    WeightVector::Storage storage = (layout == kLayoutSparse) ?
+      WeightVector::kSparse : WeightVector::kDense;
+    for (int i = 0; i < num_submodels; ++i)
+    {
+      WeightVector w (num_features, storage, precision, i);
+      submodels_.push_back (w);
+    }
+    return;
+  }
+
+  // Weight of feature i in submodel j is at i * num_submodels + j
+  submodels_.clear ();
+  submodels_.reserve (num_submodels);
+  std::vector<float> (size_t (num_features) * num_submodels, 0)
+    .swap (weights_);
+  for (int j = 0; j < num_submodels; ++j)
+    submodels_.emplace_back (num_features, &weights_[j], num_submodels);
+}
+
+
+// Compute inner products of instance with all submodels. For the
+// interleaved layout, the weights of all submodels are gathered by one
+// vectorizable loop per non-zero feature of the instance. The summation
+// order is the same as in WeightVector::InnerProduct.
+void Model::InnerProducts (const SparseVectorView &instance,
+  float *scores) const
+{
+  int num_submodels = submodels_.size ();
+  if (weights_.empty () || submodels_[0].lazy_l1 ())
+  {
+    for (int j = 0; j < num_submodels; ++j)
+      scores[j] = submodels_[j].InnerProduct (instance);
+    return;
+  }
+
+  for (int j = 0; j < num_submodels; ++j)
+    scores[j] = 0;
+  const float *weights = weights_.data ();
+  for (int i = 0; i < instance.size (); ++i)
+  {
+    const float *row   = weights + size_t (instance.id (i)) * num_submodels;
+    const float  value = instance.value (i);
+    for (int j = 0; j < num_submodels; ++j)
+      scores[j] += row[j] * value;
+  }
+  for (int j = 0; j < num_submodels; ++j)
+    scores[j] *= submodels_[j].scale ();
+}
+
+
+// Initialize model from a binary model file with num_submodels and at
+// least num_features features. Dense blocks are used in place, sparse
+// blocks are copied. The mapping is private, so changed weights are not
+// written back. Return false if the file can't be mapped, e.g. because
+// it is a text model.
+bool Model::Map (const char *file_name, int num_submodels, int num_features)
+{
+  int fd = open (file_name, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat model_stat;
+  if ((fstat (fd, &model_stat) != 0) 
+    || (size_t (model_stat.st_size) < sizeof (ModelHeader)))
+  {
+    close (fd);
+    return false;
+  }
+  size_t size = model_stat.st_size;
+  void *mapping = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+    fd, 0);
+  close (fd);
+  if (mapping == MAP_FAILED)
+  {
+    WARN << "Can't map model '" << file_name << "'" << std::endl;
+    return false;
+  }
+
+  // Validate header and blocks
+  const ModelHeader *header = static_cast<const ModelHeader *> (mapping);
+  if (memcmp (header->magic, kModelMagic, sizeof (kModelMagic)) != 0)
+  {
+    munmap (mapping, size);
+    return false;
+  }
+  if ((header->version != kModelVersion) 
+    || (header->num_submodels != uint32_t (num_submodels))
+    || (header->num_features < uint64_t (num_features))
+    || (header->num_features > uint64_t (INT_MAX)))
+  {
+    WARN << "Can't map model '" << file_name << "' with " 
+      << header->num_submodels << " submodels and " << header->num_features
+      << " features" << std::endl;
+    munmap (mapping, size);
+    return false;
+  }
+  char *begin = static_cast<char *> (mapping);
+  char *end   = begin + size;
+  char *pos   = begin + sizeof (ModelHeader);
+  for (uint32_t j = 0; j < header->num_submodels; ++j)
+  {
+    const SubmodelHeader *submodel 
+      = reinterpret_cast<const SubmodelHeader *> (pos);
+    if ((size_t (end - pos) < sizeof (SubmodelHeader))
+      || (submodel->dense && (submodel->num_weights != header->num_features))
+      || (submodel->num_weights > header->num_features)
+      || (size_t (end - pos) - sizeof (SubmodelHeader) 
+        < block_size (*submodel)))
+    {
+      WARN << "Invalid model '" << file_name << "'" << std::endl;
+      munmap (mapping, size);
+      return false;
+    }
+    pos += sizeof (SubmodelHeader);
+    const id_t *ids = reinterpret_cast<const id_t *> (pos);
+    for (uint64_t k = 0; !submodel->dense && (k < submodel->num_weights); ++k)
+    {
+      if (ids[k] >= header->num_features)
+      {
+        WARN << "Invalid feature id " << ids[k] << " in '" << file_name
+          << "'" << std::endl;
+        munmap (mapping, size);
+        return false;
+      }
+    }
+    pos += block_size (*submodel);
+  }
+
+  // Replace submodels by mapped or copied weights
+  submodels_.clear ();
+  std::vector<float> ().swap (weights_);
+  submodels_.reserve (header->num_submodels);
+  if (mapping_)
+    munmap (mapping_, mapping_size_);
+  mapping_      = mapping;
+  mapping_size_ = size;
+  pos = begin + sizeof (ModelHeader);
+  for (uint32_t j = 0; j < header->num_submodels; ++j)
+  {
+    const SubmodelHeader *submodel 
+      = reinterpret_cast<const SubmodelHeader *> (pos);
+    pos += sizeof (SubmodelHeader);
+    if (submodel->dense)
+      submodels_.emplace_back (header->num_features, 
+        reinterpret_cast<float *> (pos));
+    else
+    {
+      submodels_.emplace_back (header->num_features);
+      const id_t  *ids    = reinterpret_cast<const id_t *> (pos);
+      const float *values = reinterpret_cast<const float *> (
+        pos + submodel->num_weights * sizeof (id_t));
+      for (uint64_t k = 0; k < submodel->num_weights; ++k)
+        submodels_[j].SetWeight (ids[k], values[k]);
+    }
+    submodels_[j].set_bias (submodel->bias);
+    submodels_[j].Scale (submodel->scale);
+    pos += block_size (*submodel);
+  }
+  return true;
+}
+
+
+// Read model in text or binary format or snapshot of a delta stream,
+// detected by the file header
+void Model::Read (const char *file_name, int snapshot)
 {
-  for (int i = 0; i < num_submodels; ++i)
+  if (ModelDelta::IsDeltaStream (file_name))
+  {
+    ModelDelta::Read (file_name, snapshot, *this);
+    return;
+  }
+  std::ifstream ifs (file_name, std::ios::binary);
+  char magic[sizeof (kModelMagic)];
+  if (!ifs.read (magic, sizeof (magic)) 
+    || memcmp (magic, kModelMagic, sizeof (magic)))
   {
-    WeightVector w (num_features);
-    submodels_.push_back (w);
+    ReadText (file_name);
+    return;
   }
+  ReadBinary (file_name);
 }
 
 
-void Model::Read (const char *file_name)
+void Model::ReadText (const char *file_name)
 {
   std::ifstream ifs (file_name);
   std::string line;
@@ -46,6 +284,7 @@ void Model::Read (const char *file_name)
   for (int i = 0; i < submodels_.size (); ++i)
   {
     getline (ifs, line);
+    s.clear ();
     const char *pos = sdf_parse_line (line.c_str (), s);
     if (*pos && (*pos != '#'))
     {
@@ -53,26 +292,190 @@ void Model::Read (const char *file_name)
         << std::endl; 
       // TODO: error handling
     }
+    if (s.size () && (s.max_id () >= num_features ()))
+    {
+      FATAL << "Error in input:" << i + 1 << ": feature id " << s.max_id ()
+        << " exceeds num-features" << std::endl;
+      continue;
+    }
+    // SetWeight rounds 16 bit weights to nearest, PlusEquals stochastically
     submodels_[i].clear ();
-    submodels_[i].PlusEquals (s); 
+    for (int k = 0; k < s.size (); ++k)
+      submodels_[i].SetWeight (s.id (k), s.value (k));
     submodels_[i].set_bias (s.target ()); 
   }
 }
 
 
-void Model::Write (const char *file_name) // TODO: error handling
+void Model::ReadBinary (const char *file_name)
+{
+  std::ifstream ifs (file_name, std::ios::binary);
+  ModelHeader header;
+  ifs.read (reinterpret_cast<char *> (&header), sizeof (header));
+  if (!ifs || (header.version != kModelVersion))
+  {
+    FATAL << "Unsupported model format in '" << file_name << "'" 
+      << std::endl;
+    return;
+  }
+  if ((header.num_submodels != submodels_.size ())
+    || (header.num_features > uint64_t (num_features ())))
+  {
+    FATAL << "Model '" << file_name << "' has " << header.num_submodels
+      << " submodels with " << header.num_features << " features" 
+      << std::endl;
+    return;
+  }
+
+  std::vector<id_t>  ids;
+  std::vector<float> values;
+  for (int j = 0; j < num_submodels (); ++j)
+  {
+    SubmodelHeader submodel;
+    ifs.read (reinterpret_cast<char *> (&submodel), sizeof (submodel));
+    if (!ifs || (submodel.num_weights > header.num_features)
+      || (submodel.dense && (submodel.num_weights != header.num_features)))
+    {
+      FATAL << "Invalid model '" << file_name << "'" << std::endl;
+      return;
+    }
+    if (submodel.dense)
+    {
+      ids.clear ();
+      values.resize (block_size (submodel) / sizeof (float));
+    }
+    else
+    {
+      ids.resize (submodel.num_weights);
+      values.resize (submodel.num_weights);
+    }
+    ifs.read (reinterpret_cast<char *> (ids.data ()),
+      ids.size () * sizeof (id_t));
+    ifs.read (reinterpret_cast<char *> (values.data ()),
+      values.size () * sizeof (float));
+    if (!ifs)
+    {
+      FATAL << "Unexpected end of '" << file_name << "'" << std::endl;
+      return;
+    }
+
+    WeightVector &w = submodels_[j];
+    w.clear ();
+    w.set_bias (submodel.bias);
+    if (submodel.dense)
+    {
+      for (uint64_t i = 0; i < submodel.num_weights; ++i)
+      {
+        if (values[i] != 0)
+          w.SetWeight (i, submodel.scale * values[i]);
+      }
+      continue;
+    }
+    for (size_t k = 0; k < ids.size (); ++k)
+    {
+      if (ids[k] >= header.num_features)
+      {
+        FATAL << "Invalid feature id " << ids[k] << " in '" << file_name
+          << "'" << std::endl;
+        return;
+      }
+      w.SetWeight (ids[k], submodel.scale * values[k]);
+    }
+  }
+}
+
+
+void Model::Write (const char *file_name, Format format)
+{
+  if (format == kFormatBinary)
+    WriteBinary (file_name);
+  else
+    WriteText (file_name);
+}
+
+
+// Copy the weights of model, e.g. for writing them concurrently. The copy
+// has separate or sparse submodels and is never mapped.
+void Model::Assign (const Model &model)
+{
+  if (submodels_.size () != model.submodels_.size ())
+  {
+    submodels_.clear ();
+    weights_.clear ();
+    submodels_.reserve (model.num_submodels ());
+    for (int j = 0; j < model.num_submodels (); ++j)
+      submodels_.push_back (model[j]);
+    return;
+  }
+  for (int j = 0; j < num_submodels (); ++j)
+    submodels_[j].Assign (model[j]);
+}
+
+
+// Write one line per submodel: bias followed by the non-zero weights
+void Model::WriteText (const char *file_name) // TODO: error handling
 {
   std::ofstream ofs (file_name);
+  TextWriter writer (ofs);
+  std::vector<id_t>  ids;
+  std::vector<float> values;
   for (int j = 0; j < submodels_.size (); ++j)
   {
-    ofs << submodels_[j].bias () << " ";
-    for (int i = 0; i < submodels_[0].size (); ++i)
+    const WeightVector &w = submodels_[j];
+    writer.Put (w.bias ());
+    writer.Put (' ');
+    w.GetNonZeros (ids, values);
+    for (size_t k = 0; k < ids.size (); ++k)
+    {
+      writer.Put (int (ids[k]));
+      writer.Put (':');
+      writer.Put (values[k]);
+      writer.Put (' ');
+    }
+    writer.Put ('\n');
+  }
+}
+
+
+void Model::WriteBinary (const char *file_name) // TODO: error handling
+{
+  std::ofstream ofs (file_name, std::ios::binary);
+  ModelHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, kModelMagic, sizeof (kModelMagic));
+  header.version       = kModelVersion;
+  header.num_submodels = num_submodels ();
+  header.num_features  = num_features ();
+  ofs.write (reinterpret_cast<const char *> (&header), sizeof (header));
+
+  std::vector<id_t>  ids;
+  std::vector<float> values;
+  for (int j = 0; j < num_submodels (); ++j)
+  {
+    const WeightVector &w = submodels_[j];
+    w.GetNonZeros (ids, values);
+
+    // Sparse blocks take 8 bytes per non-zero weight, dense blocks 4 bytes
+    // per feature
+    SubmodelHeader submodel;
+    memset (&submodel, 0, sizeof (submodel));
+    submodel.bias        = w.bias ();
+    submodel.scale       = 1.0;
+    submodel.dense       = (2 * ids.size () >= size_t (num_features ()));
+    submodel.num_weights = submodel.dense ? num_features () : ids.size ();
+    if (submodel.dense)
     {
-      float weight = submodels_[j].GetWeight (i); 
-      if (weight != 0)
-        ofs << i << ':' << weight << ' ';
+      std::vector<float> weights (block_size (submodel) / sizeof (float), 0);
+      for (size_t k = 0; k < ids.size (); ++k)
+        weights[ids[k]] = values[k];
+      ids.clear ();
+      weights.swap (values);
     }
-    ofs << std::endl;
+    ofs.write (reinterpret_cast<const char *> (&submodel), sizeof (submodel));
+    ofs.write (reinterpret_cast<const char *> (ids.data ()),
+      ids.size () * sizeof (id_t));
+    ofs.write (reinterpret_cast<const char *> (values.data ()),
+      values.size () * sizeof (float));
   }
 }
 
@@ -94,3 +497,33 @@ void Model::RegularizeL2 (const float factor)
   }
 }
 
+
+
+size_t Model::memory_usage () const
+{
+  size_t usage = weights_.size () * sizeof (float);
+  for (int i = 0; i < num_submodels (); ++i)
+    usage += submodels_[i].memory_usage ();
+  return usage;
+}
+
+
+void Model::Checkpoint ()
+{
+  for (int i = 0; i < num_submodels (); ++i)
+    submodels_[i].Checkpoint ();
+}
+
+
+void Model::RestoreCheckpoint ()
+{
+  for (int i = 0; i < num_submodels (); ++i)
+    submodels_[i].RestoreCheckpoint ();
+}
+
+
+void Model::ReleaseCheckpoint ()
+{
+  for (int i = 0; i < num_submodels (); ++i)
+    submodels_[i].ReleaseCheckpoint ();
+}
@@ -23,22 +23,59 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <vector>
+
 #include "weight_vector.h"
 
 
+// Linear model with one weight vector per submodel. Models are stored as
+// text, one line per submodel, or in a binary format with a dense or a
+// sparse block per submodel. Dense blocks of binary models can be mapped
+// into memory and used as weight storage without reading them. In the
+// class-interleaved layout, the weights of all submodels for a feature
+// are contiguous, so InnerProducts scores all submodels in one pass over
+// an instance. In the sparse layout, each submodel stores only the
+// weights of features it has seen in a hash table. Weights of the separate
+// layout can be stored with 16 bit precision.
 class Model
 {
   public:
-    void Init (int num_submodels, int num_features);
-    void Read  (const char *file_name);
-    void Write (const char *file_name);
+    typedef enum { kFormatText, kFormatBinary } Format; // File format
+    typedef enum { kLayoutSeparate, kLayoutInterleaved,
+      kLayoutSparse } Layout;             // Storage of weights
+    Model ();
+    ~Model ();
+    void Init (int num_submodels, int num_features, 
+      Layout layout = kLayoutSeparate,
+      WeightVector::Precision precision = WeightVector::kFloat32);
+    bool Map   (const char *file_name, int num_submodels, int num_features);
+    void Read  (const char *file_name, int snapshot = -1);
+    void Write (const char *file_name, Format format = kFormatText);
+    void Assign (const Model &model);     // Copy weights, reusing storage
     WeightVector &operator[] (int index); // TODO: do we really want this?
+    const WeightVector &operator[] (int index) const;
     int num_submodels () const;
     int num_features () const;
+    void InnerProducts (const SparseVectorView &instance, 
+      float *scores) const;                  // Scores of all submodels
     void RegularizeL1 (const float factor);
     void RegularizeL2 (const float factor);
+    size_t memory_usage () const;            // Bytes used by weights
+    void Checkpoint ();                      // Remember current model
+    void RestoreCheckpoint ();               // Return to remembered model
+    void ReleaseCheckpoint ();               // Forget remembered model
   private:
+    Model (const Model &copy);                 // Not copyable
+    Model &operator= (const Model &copy);      // Not assignable
+    void ReadText    (const char *file_name);
+    void ReadBinary  (const char *file_name);
+    void WriteText   (const char *file_name);
+    void WriteBinary (const char *file_name);
+
     std::vector<WeightVector> submodels_;
+    std::vector<float> weights_;          // Class-interleaved weights
+    void  *mapping_;                      // Mapped model file or NULL
+    size_t mapping_size_;                 // Size of mapped model file
 };
 
 
@@ -48,6 +85,12 @@ inline WeightVector &Model::operator[] (int index)
 }
 
 
+inline const WeightVector &Model::operator[] (int index) const
+{
+  return submodels_[index];
+}
+
+
 inline int Model::num_submodels () const
 {
   return submodels_.size ();
@@ -0,0 +1,301 @@
+// Implementation of delta-encoded model snapshots
+//
+// Copyright (C) Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cstring>
+#include <fstream>
+
+#include <stdint.h>
+
+#include "model_delta.h"
+#include "tiny_log.h"
+#include "weight_table.h"
+
+
+// Delta stream format. The header is followed by records, each consisting
+// of a RecordHeader and one block per submodel: a DeltaSubmodelHeader,
+// num_weights ids, num_weights stored weights and, if lazy_l1, num_weights
+// applied L1 penalties. Weights are scale * stored weight, truncated by
+// l1_penalty minus the applied penalty if lazy_l1. The first record is
+// full. An incomplete last record, e.g. of an interrupted run, is ignored.
+const char     kDeltaMagic[8] = { 'S', 'O', 'L', 'D', 'E', 'L', 'T', 'A' };
+const uint32_t kDeltaVersion  = 2;
+
+struct DeltaHeader
+{
+  char     magic[8];      // kDeltaMagic
+  uint32_t version;       // kDeltaVersion
+  uint32_t num_submodels; // Number of submodels
+  uint64_t num_features;  // Number of features
+};
+
+struct RecordHeader
+{
+  uint64_t size;          // Bytes following the record header
+  int64_t  iteration;     // Iteration of snapshot
+  uint32_t full;          // 1 if record holds all non-zero weights
+  uint32_t reserved;      // Always 0
+};
+
+struct DeltaSubmodelHeader
+{
+  float    bias;          // Bias of submodel
+  float    scale;         // Scale of stored weights
+  double   l1_penalty;    // Cumulative L1 penalty
+  uint32_t lazy_l1;       // 1 if applied penalties follow the weights
+  uint32_t reserved;      // Always 0
+  uint64_t num_weights;   // Number of stored weights in record
+};
+
+
+// Copy bias, scale, L1 penalty and the changed or all non-zero stored
+// weights of each submodel and restart tracking its changes
+void ModelDelta::Capture (Model &model, int64_t iteration, bool full)
+{
+  iteration_ = iteration;
+  full_      = full;
+  submodels_.resize (model.num_submodels ());
+  for (int j = 0; j < model.num_submodels (); ++j)
+  {
+    WeightVector &w = model[j];
+    Submodel &submodel  = submodels_[j];
+    submodel.bias       = w.bias ();
+    submodel.scale      = w.scale ();
+    submodel.l1_penalty = w.l1_penalty ();
+    submodel.lazy_l1    = w.lazy_l1 ();
+    w.GetStoredWeights (!full, submodel.ids, submodel.weights,
+      submodel.l1_applied);
+    w.TrackChanges ();
+  }
+}
+
+
+size_t ModelDelta::num_weights () const
+{
+  size_t count = 0;
+  for (size_t j = 0; j < submodels_.size (); ++j)
+    count += submodels_[j].ids.size ();
+  return count;
+}
+
+
+void ModelDelta::WriteHeader (std::ostream &out, int num_submodels,
+  int num_features)
+{
+  DeltaHeader header;
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, kDeltaMagic, sizeof (kDeltaMagic));
+  header.version       = kDeltaVersion;
+  header.num_submodels = num_submodels;
+  header.num_features  = num_features;
+  out.write (reinterpret_cast<const char *> (&header), sizeof (header));
+}
+
+
+void ModelDelta::Write (std::ostream &out) const
+{
+  RecordHeader record;
+  memset (&record, 0, sizeof (record));
+  record.iteration = iteration_;
+  record.full      = full_;
+  for (size_t j = 0; j < submodels_.size (); ++j)
+  {
+    const Submodel &submodel = submodels_[j];
+    record.size += sizeof (DeltaSubmodelHeader) 
+      + submodel.ids.size () * (sizeof (id_t) + sizeof (float))
+      + submodel.l1_applied.size () * sizeof (double);
+  }
+  out.write (reinterpret_cast<const char *> (&record), sizeof (record));
+  for (size_t j = 0; j < submodels_.size (); ++j)
+  {
+    const Submodel &submodel = submodels_[j];
+    DeltaSubmodelHeader header;
+    memset (&header, 0, sizeof (header));
+    header.bias        = submodel.bias;
+    header.scale       = submodel.scale;
+    header.l1_penalty  = submodel.l1_penalty;
+    header.lazy_l1     = submodel.lazy_l1;
+    header.num_weights = submodel.ids.size ();
+    out.write (reinterpret_cast<const char *> (&header), sizeof (header));
+    out.write (reinterpret_cast<const char *> (submodel.ids.data ()),
+      submodel.ids.size () * sizeof (id_t));
+    out.write (reinterpret_cast<const char *> (submodel.weights.data ()),
+      submodel.weights.size () * sizeof (float));
+    out.write (reinterpret_cast<const char *> (submodel.l1_applied.data ()),
+      submodel.l1_applied.size () * sizeof (double));
+  }
+  out.flush ();
+}
+
+
+bool ModelDelta::IsDeltaStream (const char *file_name)
+{
+  std::ifstream ifs (file_name, std::ios::binary);
+  char magic[sizeof (kDeltaMagic)];
+  return ifs.read (magic, sizeof (magic))
+    && !memcmp (magic, kDeltaMagic, sizeof (magic));
+}
+
+
+// Set model to snapshot index of a delta stream, counted from 0 or from
+// the end if negative. Only the record headers are read to find the last
+// full record before the snapshot, which is replayed with the following
+// delta records.
+bool ModelDelta::Read (const char *file_name, int index, Model &model)
+{
+  std::ifstream ifs (file_name, std::ios::binary);
+  DeltaHeader header;
+  ifs.read (reinterpret_cast<char *> (&header), sizeof (header));
+  if (!ifs || memcmp (header.magic, kDeltaMagic, sizeof (kDeltaMagic))
+    || (header.version != kDeltaVersion))
+  {
+    FATAL << "Unsupported snapshot format in '" << file_name << "'"
+      << std::endl;
+    return false;
+  }
+  if ((header.num_submodels != uint32_t (model.num_submodels ()))
+    || (header.num_features > uint64_t (model.num_features ())))
+  {
+    FATAL << "Snapshots '" << file_name << "' have " << header.num_submodels
+      << " submodels with " << header.num_features << " features"
+      << std::endl;
+    return false;
+  }
+
+  // Index of complete records
+  ifs.seekg (0, std::ios::end);
+  uint64_t file_size = ifs.tellg ();
+  std::vector<uint64_t> offsets;
+  std::vector<RecordHeader> records;
+  uint64_t offset = sizeof (header);
+  RecordHeader record;
+  while (offset + sizeof (record) <= file_size)
+  {
+    ifs.seekg (offset);
+    ifs.read (reinterpret_cast<char *> (&record), sizeof (record));
+    if (!ifs || (offset + sizeof (record) + record.size > file_size))
+      break;
+    offsets.push_back (offset + sizeof (record));
+    records.push_back (record);
+    offset += sizeof (record) + record.size;
+  }
+  int count = records.size ();
+  if (index < 0)
+    index += count;
+  if ((index < 0) || (index >= count))
+  {
+    FATAL << "Snapshot " << index << " not in '" << file_name << "' with "
+      << count << " snapshots" << std::endl;
+    return false;
+  }
+  int first = index;
+  while ((first > 0) && !records[first].full)
+    --first;
+  if (!records[first].full)
+  {
+    FATAL << "No full snapshot before " << index << " in '" << file_name
+      << "'" << std::endl;
+    return false;
+  }
+
+  // Replay records into a table of stored weights and applied penalties
+  // per submodel, so memory grows with the weights in the records rather
+  // than with num_features
+  int num_submodels = header.num_submodels;
+  std::vector<WeightTable> stored (num_submodels);
+  std::vector<DeltaSubmodelHeader> state (num_submodels);
+  std::vector<id_t>   ids;
+  std::vector<float>  weights;
+  std::vector<double> penalties;
+  for (int r = first; r <= index; ++r)
+  {
+    ifs.clear ();
+    ifs.seekg (offsets[r]);
+    for (int j = 0; j < num_submodels; ++j)
+    {
+      DeltaSubmodelHeader &submodel = state[j];
+      ifs.read (reinterpret_cast<char *> (&submodel), sizeof (submodel));
+      if (!ifs || (submodel.num_weights > header.num_features))
+      {
+        FATAL << "Invalid snapshots '" << file_name << "'" << std::endl;
+        return false;
+      }
+      ids.resize (submodel.num_weights);
+      weights.resize (submodel.num_weights);
+      penalties.resize (submodel.lazy_l1 ? submodel.num_weights : 0);
+      ifs.read (reinterpret_cast<char *> (ids.data ()),
+        ids.size () * sizeof (id_t));
+      ifs.read (reinterpret_cast<char *> (weights.data ()),
+        weights.size () * sizeof (float));
+      ifs.read (reinterpret_cast<char *> (penalties.data ()),
+        penalties.size () * sizeof (double));
+      if (!ifs)
+      {
+        FATAL << "Unexpected end of '" << file_name << "'" << std::endl;
+        return false;
+      }
+      WeightTable &table = stored[j];
+      if (records[r].full)
+        table.clear ();
+      if (submodel.lazy_l1 && !table.tracks_l1 ())
+        table.TrackL1 (0);
+      for (size_t k = 0; k < ids.size (); ++k)
+      {
+        if (ids[k] >= header.num_features)
+        {
+          FATAL << "Invalid feature id " << ids[k] << " in '" << file_name
+            << "'" << std::endl;
+          return false;
+        }
+        int slot = table.Insert (ids[k], 0);
+        table.weight (slot) = weights[k];
+        if (submodel.lazy_l1)
+          table.l1_applied (slot) = penalties[k];
+      }
+    }
+  }
+
+  // Weights as returned by WeightVector::GetWeight at the snapshot
+  for (int j = 0; j < num_submodels; ++j)
+  {
+    const DeltaSubmodelHeader &submodel = state[j];
+    WeightVector &w = model[j];
+    w.clear ();
+    w.set_bias (submodel.bias);
+    const WeightTable &table = stored[j];
+    for (int slot = 0; slot < table.capacity (); ++slot)
+    {
+      if ((table.id (slot) == WeightTable::kEmpty)
+        || (table.weight (slot) == 0))
+        continue;
+      float weight = submodel.scale * table.weight (slot);
+      if (submodel.lazy_l1)
+        weight = truncate_l1 (weight,
+          submodel.l1_penalty - table.l1_applied (slot));
+      if (weight != 0)
+        w.SetWeight (table.id (slot), weight);
+    }
+  }
+  INFO << "read snapshot " << index << " of iteration "
+    << records[index].iteration << std::endl;
+  return true;
+}
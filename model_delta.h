@@ -0,0 +1,78 @@
+// Header file for delta-encoded model snapshots
+//
+// Copyright (C) Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef MODEL_DELTA_H
+#define MODEL_DELTA_H
+
+#include <iostream>
+#include <vector>
+
+#include <stdint.h>
+
+#include "common.h"
+#include "model.h"
+
+
+// Snapshot of a model as a record of a delta stream. Full records hold all
+// non-zero weights, delta records only the weights changed since the
+// previous record. Both hold the stored weights of WeightVector together
+// with scale, bias and L1 penalties, so a change of scale costs nothing.
+// Any snapshot is reconstructed from the last full record before it and
+// the delta records in between.
+class ModelDelta
+{
+  public:
+    void Capture (Model &model, int64_t iteration,
+      bool full);                       // Take changes, track new ones
+    bool   full () const;               // Record holds all weights
+    size_t num_weights () const;        // Weights in record
+    static void WriteHeader (std::ostream &out, int num_submodels,
+      int num_features);                // Start of delta stream
+    void Write (std::ostream &out) const;   // Append record to stream
+    static bool IsDeltaStream (const char *file_name);
+    static bool Read (const char *file_name, int index,
+      Model &model);                    // Reconstruct snapshot index
+  private:
+    struct Submodel
+    {
+      float  bias;
+      float  scale;
+      double l1_penalty;
+      bool   lazy_l1;                   // Weights have applied penalties
+      std::vector<id_t>   ids;          // Ids of weights
+      std::vector<float>  weights;      // Stored weights
+      std::vector<double> l1_applied;   // Applied penalties or empty
+    };
+
+    int64_t iteration_;                 // Iteration of snapshot
+    bool  full_;                        // Record holds all weights
+    std::vector<Submodel> submodels_;
+};
+
+
+inline bool ModelDelta::full () const
+{
+  return full_;
+}
+
+#endif
@@ -0,0 +1,149 @@
+// Timers and counters for profiling runs
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <sstream>
+#include <string>
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+
+// Wall time per phase and event counters of a run. The PROFILE_* macros
+// only record if compiled with -DSOL_PROFILE (make PROFILE=1), otherwise
+// they expand to nothing and the hot paths are unchanged.
+class Profile
+{
+  public:
+    typedef enum
+    {
+      kRead,                          // Reading data and validation data
+      kModel,                         // Initializing and reading model
+      kLearn,                         // Learning, including the following
+      kLossUpdate,                    // Loss updates
+      kRegularize,                    // Regularization and projection
+      kIntermediate,                  // Writing intermediate models
+      kValidate,                      // Validation
+      kEvaluate,                      // Evaluation
+      kWrite,                         // Writing final model
+      kNumTimers
+    } Timer;
+    typedef enum
+    {
+      kBytesParsed,                   // Bytes of data files parsed
+      kBytesStreamed,                 // Bytes parsed while learning
+      kIterations,                    // Learning steps
+      kUpdates,                       // Steps which changed the model
+      kEvaluated,                     // Instances evaluated
+      kNumCounters
+    } Counter;
+    Profile ();
+    void Start (Timer timer);
+    void Stop (Timer timer);
+    void Add (Counter counter, uint64_t count);
+    std::string Summary () const;     // One line of JSON
+    static uint64_t FileSize (const char *file_name);
+  private:
+    std::chrono::steady_clock::time_point start_[kNumTimers];
+    double   seconds_[kNumTimers];    // Total time per timer
+    uint64_t counts_[kNumCounters];   // Total per counter
+};
+
+#ifdef SOL_PROFILE
+#define PROFILE_START(timer)      profile_.Start (Profile::timer)
+#define PROFILE_STOP(timer)       profile_.Stop (Profile::timer)
+#define PROFILE_ADD(counter, n)   profile_.Add (Profile::counter, n)
+#else
+#define PROFILE_START(timer)      ((void) 0)
+#define PROFILE_STOP(timer)       ((void) 0)
+#define PROFILE_ADD(counter, n)   ((void) 0)
+#endif
+
+
+inline Profile::Profile ()
+{
+  for (int i = 0; i < kNumTimers; ++i)
+    seconds_[i] = 0;
+  for (int i = 0; i < kNumCounters; ++i)
+    counts_[i] = 0;
+}
+
+
+inline void Profile::Start (Timer timer)
+{
+  start_[timer] = std::chrono::steady_clock::now ();
+}
+
+
+inline void Profile::Stop (Timer timer)
+{
+  seconds_[timer] += std::chrono::duration<double> (
+    std::chrono::steady_clock::now () - start_[timer]).count ();
+}
+
+
+inline void Profile::Add (Counter counter, uint64_t count)
+{
+  counts_[counter] += count;
+}
+
+
+inline uint64_t Profile::FileSize (const char *file_name)
+{
+  struct stat file_stat;
+  return (stat (file_name, &file_stat) == 0) ? file_stat.st_size : 0;
+}
+
+
+// Times in seconds, counters and the derived rates
+inline std::string Profile::Summary () const
+{
+  const char *timer_names[kNumTimers] = { "read", "model", "learn",
+    "loss_update", "regularize", "intermediate_models", "validate",
+    "evaluate", "write" };
+  const char *counter_names[kNumCounters] = { "bytes_parsed",
+    "bytes_streamed", "iterations", "updates", "evaluated" };
+  std::ostringstream oss;
+  oss << '{';
+  for (int i = 0; i < kNumTimers; ++i)
+    oss << '"' << timer_names[i] << "_seconds\": " << seconds_[i] << ", ";
+  for (int i = 0; i < kNumCounters; ++i)
+    oss << '"' << counter_names[i] << "\": " << counts_[i] << ", ";
+  oss << "\"parse_mb_per_second\": " 
+    << (seconds_[kRead] > 0 ?
+      counts_[kBytesParsed] / 1e6 / seconds_[kRead] : 0)
+    << ", \"iterations_per_second\": "
+    << (seconds_[kLearn] > 0 ? counts_[kIterations] / seconds_[kLearn] : 0)
+    << ", \"updated_fraction\": "
+    << (counts_[kIterations] ?
+      double (counts_[kUpdates]) / counts_[kIterations] : 0)
+    << ", \"evaluated_per_second\": "
+    << (seconds_[kEvaluate] > 0 ? counts_[kEvaluated] / seconds_[kEvaluate] : 0)
+    << '}';
+  return oss.str ();
+}
+
+#endif
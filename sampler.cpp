@@ -0,0 +1,63 @@
+// Implementation of random number generation and instance sampling
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+
+#include "sampler.h"
+
+
+// The seed is scrambled by splitmix64, so that similar seeds, e.g. of
+// consecutive threads, give unrelated sequences.
+RandomEngine::RandomEngine (uint64_t seed)
+{
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  state_ = z ^ (z >> 31);
+  if (state_ == 0)
+    state_ = 0x9E3779B97F4A7C15ULL;
+}
+
+
+Sampler::Sampler (Policy policy, size_t size, uint64_t seed, size_t start)
+: policy_(policy)
+, size_(size)
+, position_(size ? start % size : 0)
+, random_(seed)
+{
+  if (policy_ == kSamplePermutation)
+  {
+    permutation_.resize (size_);
+    for (size_t i = 0; i < size_; ++i)
+      permutation_[i] = i;
+    position_ = size_;
+  }
+}
+
+
+// Fisher-Yates shuffle of the permutation, starting a new epoch
+void Sampler::Shuffle ()
+{
+  for (size_t i = size_; i > 1; --i)
+    std::swap (permutation_[i - 1], permutation_[random_.Uniform (i)]);
+  position_ = 0;
+}
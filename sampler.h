@@ -0,0 +1,117 @@
+// Header for random number generation and instance sampling
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstddef>
+
+#include <vector>
+
+#include <stdint.h>
+
+
+// Small and fast xorshift64* random number generator. Unlike rand () it
+// takes no locks, has a 64 bit range and a state per instance, so results
+// depend only on the seed.
+class RandomEngine
+{
+  public:
+    RandomEngine (uint64_t seed);
+    uint64_t Next ();                 // Next 64 bit random number
+    size_t   Uniform (size_t n);      // Unbiased random number in [0, n)
+  private:
+    uint64_t state_;                  // Generator state, never 0
+};
+
+
+// Sampling policy for drawing instance indices from [0, size)
+class Sampler
+{
+  public:
+    typedef enum 
+    { 
+      kSampleUniform,                 // Uniform with replacement
+      kSamplePermutation,             // Random permutation per epoch
+      kSampleSequential               // In order
+    } Policy;
+    Sampler (Policy policy, size_t size, uint64_t seed, size_t start = 0);
+    size_t Next ();                   // Next instance index
+  private:
+    void Shuffle ();                  // New random permutation
+
+    Policy policy_;                   // Sampling policy
+    size_t size_;                     // Number of instances
+    size_t position_;                 // Position in epoch
+    RandomEngine random_;             // Random number generator
+    std::vector<size_t> permutation_; // Order of current epoch
+};
+
+
+inline uint64_t RandomEngine::Next ()
+{
+  state_ ^= state_ >> 12;
+  state_ ^= state_ << 25;
+  state_ ^= state_ >> 27;
+  return state_ * 2685821657736338717ULL;
+}
+
+
+// Lemire's multiply-and-shift with rejection of the biased low range
+inline size_t RandomEngine::Uniform (size_t n)
+{
+  unsigned __int128 product = (unsigned __int128) Next () * n;
+  uint64_t low = uint64_t (product);
+  if (low < n)
+  {
+    uint64_t threshold = - uint64_t (n) % n;
+    while (low < threshold)
+    {
+      product = (unsigned __int128) Next () * n;
+      low = uint64_t (product);
+    }
+  }
+  return product >> 64;
+}
+
+
+inline size_t Sampler::Next ()
+{
+  switch (policy_)
+  {
+    case kSamplePermutation:
+      if (position_ >= size_)
+        Shuffle ();
+      return permutation_[position_++];
+
+    case kSampleSequential:
+      if (position_ >= size_)
+        position_ = 0;
+      return position_++;
+
+    case kSampleUniform:
+    default:
+      return random_.Uniform (size_);
+  }
+}
+
+#endif
@@ -0,0 +1,148 @@
+// Implementation of asynchronous model snapshots
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cstdio>
+
+#include "snapshot_writer.h"
+#include "tiny_log.h"
+
+
+SnapshotWriter::SnapshotWriter (const std::string &prefix,
+  Model::Format format, bool deltas, int num_buffers)
+: prefix_(prefix)
+, format_(format)
+, buffers_(deltas ? NULL : new Model[num_buffers])
+, deltas_(deltas ? new ModelDelta[num_buffers] : NULL)
+, num_captures_(0)
+, full_weights_(0)
+, delta_weights_(0)
+, stop_(false)
+, num_waits_(0)
+{
+  if (deltas)
+  {
+    std::string file_name = prefix + ".snapshots";
+    stream_.open (file_name.c_str (), std::ios::binary);
+    if (!stream_)
+      FATAL << "Can't open '" << file_name << "'" << std::endl;
+  }
+  for (int b = 0; b < num_buffers; ++b)
+    free_.push_back (b);
+  writer_ = std::thread (&SnapshotWriter::WriteLoop, this);
+}
+
+
+SnapshotWriter::~SnapshotWriter ()
+{
+  {
+    std::lock_guard<std::mutex> lock (mutex_);
+    stop_ = true;
+  }
+  not_empty_.notify_one ();
+  writer_.join ();
+  delete[] buffers_;
+  delete[] deltas_;
+}
+
+
+// Copy model into a free buffer and queue it. Without a free buffer,
+// wait for one or return false. The copy is made without holding the
+// lock, the buffer belongs to the caller until it is queued.
+bool SnapshotWriter::Capture (Model &model, int64_t iteration,
+  bool wait)
+{
+  std::unique_lock<std::mutex> lock (mutex_);
+  if (free_.empty ())
+    ++num_waits_;
+  if (free_.empty () && !wait)
+    return false;
+  while (free_.empty ())
+    not_full_.wait (lock);
+  int buffer = free_.back ();
+  free_.pop_back ();
+  lock.unlock ();
+
+  if (!deltas_)
+    buffers_[buffer].Assign (model);
+  else
+  {
+    // The writer thread is idle before the first snapshot is queued
+    size_t num_changes = 0;
+    for (int j = 0; j < model.num_submodels (); ++j)
+      num_changes += model[j].num_changes ();
+    bool full = (num_captures_ == 0)
+      || (delta_weights_ + num_changes > full_weights_);
+    if (num_captures_ == 0)
+      ModelDelta::WriteHeader (stream_, model.num_submodels (),
+        model.num_features ());
+    ModelDelta &delta = deltas_[buffer];
+    delta.Capture (model, iteration, full);
+    if (full)
+    {
+      full_weights_  = delta.num_weights ();
+      delta_weights_ = 0;
+    }
+    else
+      delta_weights_ += delta.num_weights ();
+  }
+  ++num_captures_;
+
+  lock.lock ();
+  queue_.push_back (Snapshot (buffer, iteration));
+  lock.unlock ();
+  not_empty_.notify_one ();
+  return true;
+}
+
+
+// Write snapshots in the order of capture until stopped and the queue
+// is empty
+void SnapshotWriter::WriteLoop ()
+{
+  const int kBufSize = 1000;
+  char file_name[kBufSize];
+  std::unique_lock<std::mutex> lock (mutex_);
+  while (true)
+  {
+    while (queue_.empty () && !stop_)
+      not_empty_.wait (lock);
+    if (queue_.empty ())
+      return;
+    Snapshot snapshot = queue_.front ();
+    queue_.pop_front ();
+    lock.unlock ();
+
+    if (deltas_)
+      deltas_[snapshot.first].Write (stream_);
+    else
+    {
+      snprintf (file_name, kBufSize, "%s.%08llx", prefix_.c_str (),
+        (unsigned long long) snapshot.second);
+      buffers_[snapshot.first].Write (file_name, format_);
+    }
+
+    lock.lock ();
+    free_.push_back (snapshot.first);
+    not_full_.notify_one ();
+  }
+}
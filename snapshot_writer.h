@@ -0,0 +1,87 @@
+// Header file for asynchronous model snapshots
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef SNAPSHOT_WRITER_H
+#define SNAPSHOT_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "model.h"
+#include "model_delta.h"
+
+
+// Writer of intermediate models. Capture copies the model into one of a
+// fixed number of buffers and a background thread writes the queued
+// copies to files named by the prefix and the iteration. Learning only
+// waits for the copy, not for formatting and writing, unless all buffers
+// are queued. With deltas, only weights changed since the last snapshot
+// are copied and appended to the delta stream prefix.snapshots. A full
+// record is written instead when replaying the deltas since the last
+// one would read more weights than it holds.
+class SnapshotWriter
+{
+  public:
+    SnapshotWriter (const std::string &prefix, Model::Format format,
+      bool deltas, int num_buffers);
+    ~SnapshotWriter ();                   // Write queued snapshots
+    bool Capture (Model &model, int64_t iteration,
+      bool wait);                         // Queue snapshot if possible
+    int  num_waits () const;              // Captures without free buffer
+  private:
+    typedef std::pair<int, int64_t> Snapshot; // Buffer and iteration
+    SnapshotWriter (const SnapshotWriter &copy);            // Not copyable
+    SnapshotWriter &operator= (const SnapshotWriter &copy); // Not assignable
+    void WriteLoop ();                    // Writer thread
+
+    std::string prefix_;                  // File name before iteration
+    Model::Format format_;                // Format of written models
+    Model *buffers_;                      // Copies of the model or NULL
+    ModelDelta *deltas_;                  // Changes of the model or NULL
+    std::ofstream stream_;                // Delta stream
+    int    num_captures_;                 // Captured snapshots
+    size_t full_weights_;                 // Weights in last full record
+    size_t delta_weights_;                // Weights in deltas since then
+    std::vector<int> free_;               // Buffers not in queue_
+    std::deque<Snapshot> queue_;          // Snapshots to write
+    std::thread writer_;                  // Writer thread
+    std::mutex  mutex_;                   // Guards free_, queue_, stop_
+    std::condition_variable not_empty_;   // Signals snapshots or stop_
+    std::condition_variable not_full_;    // Signals free buffers
+    bool  stop_;                          // Write queue_ and stop
+    int   num_waits_;                     // Captures without free buffer
+};
+
+
+inline int SnapshotWriter::num_waits () const
+{
+  return num_waits_;
+}
+
+#endif
@@ -22,25 +22,276 @@
 
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+
+#include <stdint.h>
 
 #include "tiny_log.h"
 #include "sparse_data_format.h"
 
 
+// Check for white space as isspace () in the "C" locale
+static inline bool sdf_is_space (char c)
+{
+  return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+
+static inline bool sdf_is_digit (char c)
+{
+  return (c >= '0') && (c <= '9');
+}
+
+
+// Parse a feature id, i.e. a non-empty sequence of decimal digits.
+// Return pointer behind the id or line, if no valid id was found.
+static const char *sdf_parse_id (const char *line, id_t &id)
+{
+  const char *pos = line;
+  unsigned long long value = 0;
+  const unsigned long long kMaxId = id_t (-1);
+
+  while (sdf_is_digit (*pos))
+  {
+    value = 10 * value + (*pos - '0');
+    if (value > kMaxId)
+      return line;
+    ++pos;
+  }
+  id = value;
+  return pos;
+}
+
+
+// MurmurHash3 (x86, 32 bit) of the bytes in [begin, end) with seed 0
+static uint32_t sdf_hash (const char *begin, const char *end)
+{
+  const uint32_t c1 = 0xcc9e2d51;
+  const uint32_t c2 = 0x1b873593;
+  size_t   length = end - begin;
+  uint32_t h = 0;
+  const char *pos = begin;
+  for (; end - pos >= 4; pos += 4)
+  {
+    uint32_t k;
+    memcpy (&k, pos, 4);
+    k *= c1;
+    k  = (k << 15) | (k >> 17);
+    k *= c2;
+    h ^= k;
+    h  = (h << 13) | (h >> 19);
+    h  = h * 5 + 0xe6546b64;
+  }
+  uint32_t k = 0;
+  switch (end - pos)
+  {
+    case 3: k ^= uint32_t (uint8_t (pos[2])) << 16; // fall through
+    case 2: k ^= uint32_t (uint8_t (pos[1])) << 8;  // fall through
+    case 1: k ^= uint32_t (uint8_t (pos[0]));
+      k *= c1;
+      k  = (k << 15) | (k >> 17);
+      k *= c2;
+      h ^= k;
+  }
+  h ^= length;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+
+// Parse a floating point number like strtof () in the "C" locale.
+// Numbers of the form [+-]digits[.digits][(e|E)[+-]digits] with at most
+// 7 significant digits and a decimal exponent within [-10, 10] are 
+// converted exactly by a single float multiplication or division, which
+// covers everything written by Model::Write. All other numbers, e.g. 
+// longer mantissas, hex floats, inf and nan, are passed on to strtof ().
+// Return pointer behind the number or line, if no number was found.
+static const char *sdf_parse_float (const char *line, float &value)
+{
+  static const float kPowersOfTen[] =
+    { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+  const int kMaxDigits   = 7;  // 10^7 < 2^24, i.e. exact in float
+  const int kMaxExponent = 10; // 10^10 is exact in float
+  const char *pos = line;
+
+  while (sdf_is_space (*pos)) ++pos;
+
+  // Sign
+  bool negative = (*pos == '-');
+  if ((*pos == '-') || (*pos == '+'))
+    ++pos;
+
+  // Mantissa
+  unsigned mantissa = 0;
+  int  num_digits = 0; // significant digits
+  int  exponent   = 0;
+  bool found_digit = false;
+  while (sdf_is_digit (*pos))
+  {
+    found_digit = true;
+    if (num_digits || (*pos != '0'))
+    {
+      if (num_digits < kMaxDigits)
+        mantissa = 10 * mantissa + (*pos - '0');
+      ++num_digits;
+    }
+    ++pos;
+  }
+  if (*pos == '.')
+  {
+    ++pos;
+    while (sdf_is_digit (*pos))
+    {
+      found_digit = true;
+      if (num_digits || (*pos != '0'))
+      {
+        if (num_digits < kMaxDigits)
+          mantissa = 10 * mantissa + (*pos - '0');
+        ++num_digits;
+      }
+      --exponent;
+      ++pos;
+    }
+  }
+  if (!found_digit || (num_digits > kMaxDigits) || (*pos == 'x')
+    || (*pos == 'X'))
+  {
+    char *end;
+    value = strtof (line, &end);
+    return end;
+  }
+
+  // Exponent
+  if ((*pos == 'e') || (*pos == 'E'))
+  {
+    const char *exp_pos = pos + 1;
+    bool exp_negative = (*exp_pos == '-');
+    if ((*exp_pos == '-') || (*exp_pos == '+'))
+      ++exp_pos;
+    if (sdf_is_digit (*exp_pos))
+    {
+      int exp_value = 0;
+      while (sdf_is_digit (*exp_pos))
+      {
+        if (exp_value < 1000)
+          exp_value = 10 * exp_value + (*exp_pos - '0');
+        ++exp_pos;
+      }
+      exponent += exp_negative ? -exp_value : exp_value;
+      pos = exp_pos;
+    }
+  }
+  if (mantissa == 0)
+    exponent = 0;
+  if ((exponent < - kMaxExponent) || (exponent > kMaxExponent))
+  {
+    char *end;
+    value = strtof (line, &end);
+    return end;
+  }
+
+  value = mantissa;
+  if (exponent < 0)
+    value /= kPowersOfTen[- exponent];
+  else
+    value *= kPowersOfTen[exponent];
+  if (negative)
+    value = - value;
+  return pos;
+}
+
+
+static bool sdf_less_id (const SparseVector::elem_t &a,
+  const SparseVector::elem_t &b)
+{
+  return a.first < b.first;
+}
+
+
+// Parse features with hashed names until end of line or comment char.
+// Ids start at 1 like in unhashed data. Features are sorted by id and
+// values of colliding names are added.
+static const char *sdf_parse_hashed_features (const char *line,
+  SparseVector &features, int hash_bits)
+{
+  static thread_local std::vector<SparseVector::elem_t> elems;
+  const uint32_t mask = (uint32_t (1) << hash_bits) - 1;
+  const char *pos = line;
+  const char *end;
+
+  elems.clear ();
+  while ((*pos) && (*pos != '#'))
+  {
+    // read feature name
+    end = pos;
+    while (*end && (*end != ':') && !sdf_is_space (*end))
+      ++end;
+    if (pos == end)
+    {
+      FATAL << "Can't read feature name" << std::endl;
+      return pos;
+    }
+    id_t id = (sdf_hash (pos, end) & mask) + 1;
+    pos = end;
+
+    // read separator
+    if (*pos != ':')
+    {
+      FATAL << "Colon ':' expected" << std::endl;
+      return pos; 
+    }
+    ++pos;
+
+    // read feature value
+    float value;
+    end = sdf_parse_float (pos, value);
+    if (pos == end)
+    {
+      FATAL << "Can't read feature value" << std::endl;
+      return pos;    
+    }
+    pos = end;
+    elems.push_back (std::make_pair (id, value));
+
+    // eat white space
+    while (sdf_is_space (*pos)) ++pos;  
+  }
+
+  // append to vector in order of ids, merging collisions
+  std::stable_sort (elems.begin (), elems.end (), sdf_less_id);
+  for (size_t i = 0; i < elems.size (); )
+  {
+    SparseVector::elem_t elem = elems[i];
+    for (++i; (i < elems.size ()) && (elems[i].first == elem.first); ++i)
+      elem.second += elems[i].second;
+    features.push_back (elem);
+  }
+  return pos;
+}
+
+
 // Parse a line in sparse data format and convert it to SparseVector.
 // Return pointer to first unread chararcter, i.e. a successful
 // parse ends at '\0' or at '#'.
-const char *sdf_parse_line (const char *line, SparseVector &features)
+const char *sdf_parse_line (const char *line, SparseVector &features,
+  int hash_bits)
 {
   const char *pos = line;
-  char *end;
+  const char *end;
 
   // target value
-  float value = strtof (pos, &end);
+  float value;
+  end = sdf_parse_float (pos, value);
   if (pos == end)
   {
     FATAL << "Can't read target value" << std::endl;
@@ -52,21 +303,23 @@ const char *sdf_parse_line (const char *line, SparseVector &features)
   // TODO: optional query id
 
   // eat white space
-  while (isspace (*pos)) ++pos;  
+  while (sdf_is_space (*pos)) ++pos;  
 
   // features
-  int last_id = 0;
+  if (hash_bits > 0)
+    return sdf_parse_hashed_features (pos, features, hash_bits);
+  id_t last_id = 0;
   while ((*pos) && (*pos != '#')) // until end of line or comment char
   {
     // read feature id
-    unsigned long convert_buffer = strtoul (pos, &end, 10);
+    id_t id;
+    end = sdf_parse_id (pos, id);
     if (pos == end)
     {
       FATAL << "Can't read feature id" << std::endl;
       return pos;
     }
     pos = end;
-    id_t id (convert_buffer); // TODO: check for overflow
 
     // check increasing order
     if (last_id >= id)
@@ -86,7 +339,8 @@ const char *sdf_parse_line (const char *line, SparseVector &features)
     ++pos;
 
     // read feature value
-    float value = strtof (pos, &end);
+    float value;
+    end = sdf_parse_float (pos, value);
     if (pos == end)
     {
       FATAL << "Can't read feature value" << std::endl;
@@ -98,7 +352,7 @@ const char *sdf_parse_line (const char *line, SparseVector &features)
     features.push_back (std::make_pair (id, value));
 
     // eat white space
-    while (isspace (*pos)) ++pos;  
+    while (sdf_is_space (*pos)) ++pos;  
   }  
 
   return pos; 
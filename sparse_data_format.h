@@ -25,6 +25,10 @@
 
 #include "sparse_vector.h"
 
-const char *sdf_parse_line (const char *line, SparseVector &features);
+// Parse a line in sparse data format. If hash_bits > 0, feature names
+// may be arbitrary strings without white space and ':', which are hashed
+// into the ids 1 ... 2^hash_bits.
+const char *sdf_parse_line (const char *line, SparseVector &features,
+  int hash_bits = 0);
 
 #endif
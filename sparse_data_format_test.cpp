@@ -20,22 +20,233 @@
 // along with Sol.  If not, see <http://www.gnu.org/licenses/>.
 
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "sparse_data_format.h"
 #include "sparse_vector.h"
 #include "tiny_logging.h"
 
 
+// Parse "0 1:text" and compare the feature value bitwise with strtof ()
+static bool check_value (const std::string &text)
+{
+  std::string line = "0 1:" + text;
+  SparseVector features;
+  const char *pos = sdf_parse_line (line.c_str (), features);
+  float expected = strtof (text.c_str (), NULL);
+  float value    = (features.size () == 1) ? features.value (0) : 0;
+  bool  equal    = (std::isnan (expected) && std::isnan (value))
+    || (memcmp (&expected, &value, sizeof (float)) == 0);
+  if (*pos || (features.size () != 1) || !equal)
+  {
+    std::cerr << "FAILED: value '" << text << "' parsed as " << value
+      << ", expected " << expected << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+// Parse line and compare the error column (0 on success) and size
+static bool check_line (const char *line, int error_column, int size,
+  int hash_bits = 0)
+{
+  SparseVector features;
+  const char *pos = sdf_parse_line (line, features, hash_bits);
+  int column = (*pos && (*pos != '#')) ? pos - line + 1 : 0;
+  if ((column != error_column) || (column == 0 && features.size () != size))
+  {
+    std::cerr << "FAILED: line '" << line << "' error column " << column
+      << " (expected " << error_column << "), size " << features.size ()
+      << " (expected " << size << ")" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+// Parse line with hashed feature names and compare ids and values
+static bool check_hashed (const char *line, int hash_bits, int size,
+  const id_t *ids, const float *values)
+{
+  SparseVector features;
+  const char *pos = sdf_parse_line (line, features, hash_bits);
+  bool equal = !*pos && (features.size () == size);
+  for (int i = 0; equal && (i < size); ++i)
+    equal = (features.id (i) == ids[i]) && (features.value (i) == values[i]);
+  if (!equal)
+  {
+    std::cerr << "FAILED: hashed line '" << line << "'" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+// Correctness tests, return number of failures
+static int test_parser ()
+{
+  int failures = 0;
+
+  // Special values
+  const char *values[] = { "1", "-1", "+1", "0", "-0", "0.5", ".5", "5.",
+    "0.1", "0.3", "1e5", "1E-5", "1.5e+3", "007", "0.0000001",
+    "1e-10", "1e-11", "1e10", "1e11", "9999999", "16777217", "123456789",
+    "3.4028235e38", "1e39", "1.17549435e-38", "1e-45", "1e-50",
+    "0.10000000", "1.0000001", "nan", "inf", "-inf", "0x1p-3", 
+    "  2.5", NULL };
+  for (int i = 0; values[i]; ++i)
+    failures += !check_value (values[i]);
+
+  // Round trip of values as written by Model::Write and with full
+  // float precision
+  srand (1);
+  for (int i = 0; i < 1000000; ++i)
+  {
+    unsigned bits = (unsigned (rand ()) << 16) ^ unsigned (rand ());
+    float value;
+    memcpy (&value, &bits, sizeof (float));
+    if (i % 2)
+      value = (rand () - RAND_MAX / 2) / float (rand () % 100000 + 1);
+    if (std::isnan (value) || std::isinf (value))
+      continue;
+    std::ostringstream model_format;
+    std::ostringstream full_format;
+    model_format << value;
+    full_format.precision (9);
+    full_format << value;
+    failures += !check_value (model_format.str ());
+    failures += !check_value (full_format.str ());
+    if (failures > 10)
+      break;
+  }
+
+  // Lines
+  failures += !check_line ("1", 0, 0);
+  failures += !check_line ("-1 1:1 2:0.5 10:-3", 0, 3);
+  failures += !check_line ("+1 1:1 2:0.5 # comment 3:1", 0, 2);
+  failures += !check_line ("1\t1:1  \t2:1\r", 0, 2);
+  failures += !check_line ("1 4294967295:1", 0, 1);
+  failures += !check_line ("x 1:1", 1, 0);
+  failures += !check_line ("1 a:1", 3, 0);
+  failures += !check_line ("1 -1:1", 3, 0);
+  failures += !check_line ("1 4294967296:1", 3, 0);
+  failures += !check_line ("1 0:1", 4, 0);
+  failures += !check_line ("1 2:1 1:1", 8, 0);
+  failures += !check_line ("1 1 2", 4, 0);
+  failures += !check_line ("1 1:x", 5, 0);
+  failures += !check_line ("1 1:1x", 6, 0);
+  failures += !check_line ("1 1:1e", 6, 0);
+
+  // Hashed names, id = 1 + MurmurHash3 ("hello") = 1 + 0x248bfa47
+  const id_t  hello_id[]    = { 0x248bfa48 };
+  const float hello_value[] = { 2 };
+  failures += !check_hashed ("1 hello:2", 31, 1, hello_id, hello_value);
+  const id_t  masked_id[]   = { (0x248bfa47 & 0xffff) + 1 };
+  failures += !check_hashed ("1 hello:2", 16, 1, masked_id, hello_value);
+  const id_t  sorted_ids[]    = { 4, 72, 179 };
+  const float sorted_values[] = { 0.5, 1.25, 2 };
+  failures += !check_hashed ("1 hello:1 a:2 b:0.5 hello:0.25", 8, 3,
+    sorted_ids, sorted_values);
+  const id_t  merged_ids[]    = { 1, 2 };
+  const float merged_values[] = { 1, 6 };
+  failures += !check_hashed ("1 a:1 b:2 hello:4", 1, 2, merged_ids,
+    merged_values);
+  failures += !check_line ("1 :1", 3, 0, 8);
+  failures += !check_line ("1 a 1", 4, 0, 8);
+  failures += !check_line ("1 a:x", 5, 0, 8);
+  failures += !check_line ("1 feature_1:1 12345:2 # comment", 0, 2, 8);
+  
+  return failures;
+}
+
+
+// Measure parsing speed on synthetic data
+static void benchmark_parser ()
+{
+  const int kNumLines    = 100000;
+  const int kNumFeatures = 50;
+  std::vector<std::string> lines;
+  size_t bytes = 0;
+
+  srand (1);
+  for (int i = 0; i < kNumLines; ++i)
+  {
+    std::ostringstream line;
+    line << ((rand () % 2) ? 1 : -1);
+    id_t id = 0;
+    for (int j = 0; j < kNumFeatures; ++j)
+    {
+      id += rand () % 1000 + 1;
+      line << ' ' << id << ':' << rand () / float (RAND_MAX);
+    }
+    lines.push_back (line.str ());
+    bytes += lines.back ().size () + 1;
+  }
+
+  // sdf_parse_line
+  SparseVector features;
+  clock_t start = clock ();
+  for (int i = 0; i < kNumLines; ++i)
+  {
+    features.clear ();
+    sdf_parse_line (lines[i].c_str (), features);
+  }
+  double parse_time = double (clock () - start) / CLOCKS_PER_SEC;
+
+  // Reference: number conversion by strtof and strtoul only
+  float sum = 0;
+  start = clock ();
+  for (int i = 0; i < kNumLines; ++i)
+  {
+    char *pos = const_cast<char *> (lines[i].c_str ());
+    sum += strtof (pos, &pos);
+    while (*pos)
+    {
+      sum += strtoul (pos, &pos, 10);
+      sum += strtof (pos + 1, &pos);
+    }
+  }
+  double libc_time = double (clock () - start) / CLOCKS_PER_SEC;
+
+  std::cout << "sdf_parse_line:  " << bytes / parse_time / 1e6 << " MB/s"
+    << std::endl;
+  std::cout << "strtof/strtoul:  " << bytes / libc_time / 1e6 << " MB/s"
+    << " (reference, " << sum << ")" << std::endl;
+}
+
+
+// Without arguments, run tests and benchmark. Otherwise parse the given
+// file ('-' for stdin) and report errors.
 int main (int argc, char **argv)
 {
+  if (argc <= 1)
+  {
+    TinyLog::SetLevel (TinyLog::Level (0));
+    int failures = test_parser ();
+    std::cout << (failures ? "FAILED" : "passed") << std::endl;
+    benchmark_parser ();
+    return failures ? 1 : 0;
+  }
+
+  std::ifstream ifs;
+  if (std::string (argv[1]) != "-")
+    ifs.open (argv[1]);
+  std::istream &in = ifs.is_open () ? ifs : std::cin;
   std::string line;
   int count = 0;
 
   TinyLog::SetLevel (TinyLog::kAll);
-  std::cout << TinyLog::level () << std::endl;
-  while (getline (std::cin, line))
+  while (getline (in, line))
   {
     count++;
     SparseVector features;
@@ -46,4 +257,5 @@ int main (int argc, char **argv)
         << std::endl; 
     }
   }
+  return 0;
 }
@@ -0,0 +1,385 @@
+// Implementation of SIMD kernels on sparse instances
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cstring>
+
+#include "sparse_kernels.h"
+
+// AVX2 and AVX-512 kernels exist on x86 only, elsewhere all kernel sets
+// but scalar are unsupported
+#if defined(__x86_64__) || defined(__i386__)
+#define SOL_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// Component values of an instance: floats, small counts stored as bytes or
+// none for binary features, which are all 1. Multiplying by 1 and by exact
+// conversions of counts leaves results identical to float values. Load8
+// and Load16 convert consecutive values, lanes outside the mask are finite.
+class FloatValues
+{
+  public:
+    FloatValues (const float *values) : values_(values) {}
+    float operator[] (int i) const { return values_[i]; }
+#ifdef SOL_X86_KERNELS
+    __attribute__ ((target ("avx2")))
+    __m256 Load8 (int i) const
+    {
+      return _mm256_loadu_ps (values_ + i);
+    }
+    __attribute__ ((target ("avx512f")))
+    __m512 Load16 (int i, int, __mmask16 mask) const
+    {
+      return _mm512_maskz_loadu_ps (mask, values_ + i);
+    }
+#endif
+  private:
+    const float *values_;
+};
+
+
+class CountValues
+{
+  public:
+    CountValues (const uint8_t *counts) : counts_(counts) {}
+    float operator[] (int i) const { return counts_[i]; }
+#ifdef SOL_X86_KERNELS
+    __attribute__ ((target ("avx2")))
+    __m256 Load8 (int i) const
+    {
+      __m128i c = _mm_loadl_epi64 ((const __m128i *) (counts_ + i));
+      return _mm256_cvtepi32_ps (_mm256_cvtepu8_epi32 (c));
+    }
+    __attribute__ ((target ("avx512f")))
+    __m512 Load16 (int i, int size, __mmask16) const
+    {
+      uint8_t tail[16] = {0};
+      const uint8_t *counts = counts_ + i;
+      if (size - i < 16)
+      {
+        memcpy (tail, counts, size - i);
+        counts = tail;
+      }
+      __m128i c = _mm_loadu_si128 ((const __m128i *) counts);
+      return _mm512_cvtepi32_ps (_mm512_cvtepu8_epi32 (c));
+    }
+#endif
+  private:
+    const uint8_t *counts_;
+};
+
+
+class BinaryValues
+{
+  public:
+    float operator[] (int) const { return 1; }
+#ifdef SOL_X86_KERNELS
+    __attribute__ ((target ("avx2")))
+    __m256 Load8 (int) const
+    {
+      return _mm256_set1_ps (1);
+    }
+    __attribute__ ((target ("avx512f")))
+    __m512 Load16 (int, int, __mmask16) const
+    {
+      return _mm512_set1_ps (1);
+    }
+#endif
+};
+
+
+template <class Values>
+static float DotScalar (const float *weights, const id_t *ids,
+  Values values, int size)
+{
+  float ip = 0;
+  for (int i = 0; i < size; ++i)
+    ip += weights[ids[i]] * values[i];
+  return ip;
+}
+
+
+template <class Values>
+static float AxpyScalar (float *weights, const id_t *ids,
+  Values values, int size, float scalar, float scale)
+{
+  float accum = 0;
+  for (int i = 0; i < size; ++i)
+  {
+    accum += values[i] * weights[ids[i]];
+    weights[ids[i]] += scalar * values[i] / scale;
+  }
+  return accum;
+}
+
+
+#ifdef SOL_X86_KERNELS
+// Shorter instances are faster without gathers
+static const int kMinGatherSize = 16;
+
+
+// Ids are used as signed 32 bit gather indices, which holds for all
+// feature ids below 2^31
+template <class Values>
+__attribute__ ((target ("avx2,fma")))
+static float DotAVX2 (const float *weights, const id_t *ids,
+  Values values, int size)
+{
+  if (size < kMinGatherSize)
+    return DotScalar (weights, ids, values, size);
+  __m256 sum = _mm256_setzero_ps ();
+  int i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    __m256i index = _mm256_loadu_si256 ((const __m256i *) (ids + i));
+    __m256 w = _mm256_i32gather_ps (weights, index, 4);
+    sum = _mm256_fmadd_ps (w, values.Load8 (i), sum);
+  }
+  __m128 half = _mm_add_ps (_mm256_castps256_ps128 (sum),
+    _mm256_extractf128_ps (sum, 1));
+  half = _mm_add_ps (half, _mm_movehl_ps (half, half));
+  half = _mm_add_ss (half, _mm_movehdup_ps (half));
+  float ip = _mm_cvtss_f32 (half);
+  for (; i < size; ++i)
+    ip += weights[ids[i]] * values[i];
+  return ip;
+}
+
+
+// AVX2 has no scatter, the updated weights are stored one by one
+template <class Values>
+__attribute__ ((target ("avx2,fma")))
+static float AxpyAVX2 (float *weights, const id_t *ids,
+  Values values, int size, float scalar, float scale)
+{
+  if (size < kMinGatherSize)
+    return AxpyScalar (weights, ids, values, size, scalar, scale);
+  __m256 sum = _mm256_setzero_ps ();
+  __m256 scalars = _mm256_set1_ps (scalar);
+  __m256 scales  = _mm256_set1_ps (scale);
+  float updated[8];
+  int i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    __m256i index = _mm256_loadu_si256 ((const __m256i *) (ids + i));
+    __m256 v = values.Load8 (i);
+    __m256 w = _mm256_i32gather_ps (weights, index, 4);
+    sum = _mm256_fmadd_ps (v, w, sum);
+    w = _mm256_add_ps (w, _mm256_div_ps (_mm256_mul_ps (scalars, v), scales));
+    _mm256_storeu_ps (updated, w);
+    for (int k = 0; k < 8; ++k)
+      weights[ids[i + k]] = updated[k];
+  }
+  __m128 half = _mm_add_ps (_mm256_castps256_ps128 (sum),
+    _mm256_extractf128_ps (sum, 1));
+  half = _mm_add_ps (half, _mm_movehl_ps (half, half));
+  half = _mm_add_ss (half, _mm_movehdup_ps (half));
+  float accum = _mm_cvtss_f32 (half);
+  for (; i < size; ++i)
+  {
+    accum += values[i] * weights[ids[i]];
+    weights[ids[i]] += scalar * values[i] / scale;
+  }
+  return accum;
+}
+
+
+// The tail is handled by masked loads and gathers
+template <class Values>
+__attribute__ ((target ("avx512f")))
+static float DotAVX512 (const float *weights, const id_t *ids,
+  Values values, int size)
+{
+  __m512 sum = _mm512_setzero_ps ();
+  for (int i = 0; i < size; i += 16)
+  {
+    __mmask16 mask = (size - i >= 16) ? 0xffff : (1 << (size - i)) - 1;
+    __m512i index = _mm512_maskz_loadu_epi32 (mask, ids + i);
+    __m512 v = values.Load16 (i, size, mask);
+    __m512 w = _mm512_mask_i32gather_ps (_mm512_setzero_ps (), mask, index,
+      weights, 4);
+    sum = _mm512_fmadd_ps (w, v, sum);
+  }
+  return _mm512_reduce_add_ps (sum);
+}
+
+
+template <class Values>
+__attribute__ ((target ("avx512f")))
+static float AxpyAVX512 (float *weights, const id_t *ids,
+  Values values, int size, float scalar, float scale)
+{
+  __m512 sum = _mm512_setzero_ps ();
+  __m512 scalars = _mm512_set1_ps (scalar);
+  __m512 scales  = _mm512_set1_ps (scale);
+  for (int i = 0; i < size; i += 16)
+  {
+    __mmask16 mask = (size - i >= 16) ? 0xffff : (1 << (size - i)) - 1;
+    __m512i index = _mm512_maskz_loadu_epi32 (mask, ids + i);
+    __m512 v = values.Load16 (i, size, mask);
+    __m512 w = _mm512_mask_i32gather_ps (_mm512_setzero_ps (), mask, index,
+      weights, 4);
+    sum = _mm512_fmadd_ps (v, w, sum);
+    w = _mm512_add_ps (w, _mm512_div_ps (_mm512_mul_ps (scalars, v), scales));
+    _mm512_mask_i32scatter_ps (weights, mask, index, w, 4);
+  }
+  return _mm512_reduce_add_ps (sum);
+}
+#endif
+
+
+// Kernels for the value encoding of an instance
+static float SparseDotScalar (const float *weights, const SparseVectorView &x)
+{
+  if (x.values ())
+    return DotScalar (weights, x.ids (), FloatValues (x.values ()), x.size ());
+  if (x.counts ())
+    return DotScalar (weights, x.ids (), CountValues (x.counts ()), x.size ());
+  return DotScalar (weights, x.ids (), BinaryValues (), x.size ());
+}
+
+
+static float SparseAxpyScalar (float *weights, const SparseVectorView &x,
+  float scalar, float scale)
+{
+  if (x.values ())
+    return AxpyScalar (weights, x.ids (), FloatValues (x.values ()), x.size (),
+      scalar, scale);
+  if (x.counts ())
+    return AxpyScalar (weights, x.ids (), CountValues (x.counts ()), x.size (),
+      scalar, scale);
+  return AxpyScalar (weights, x.ids (), BinaryValues (), x.size (), scalar,
+    scale);
+}
+
+
+#ifdef SOL_X86_KERNELS
+static float SparseDotAVX2 (const float *weights, const SparseVectorView &x)
+{
+  if (x.values ())
+    return DotAVX2 (weights, x.ids (), FloatValues (x.values ()), x.size ());
+  if (x.counts ())
+    return DotAVX2 (weights, x.ids (), CountValues (x.counts ()), x.size ());
+  return DotAVX2 (weights, x.ids (), BinaryValues (), x.size ());
+}
+
+
+static float SparseAxpyAVX2 (float *weights, const SparseVectorView &x,
+  float scalar, float scale)
+{
+  if (x.values ())
+    return AxpyAVX2 (weights, x.ids (), FloatValues (x.values ()), x.size (),
+      scalar, scale);
+  if (x.counts ())
+    return AxpyAVX2 (weights, x.ids (), CountValues (x.counts ()), x.size (),
+      scalar, scale);
+  return AxpyAVX2 (weights, x.ids (), BinaryValues (), x.size (), scalar,
+    scale);
+}
+
+
+static float SparseDotAVX512 (const float *weights, const SparseVectorView &x)
+{
+  if (x.values ())
+    return DotAVX512 (weights, x.ids (), FloatValues (x.values ()), x.size ());
+  if (x.counts ())
+    return DotAVX512 (weights, x.ids (), CountValues (x.counts ()), x.size ());
+  return DotAVX512 (weights, x.ids (), BinaryValues (), x.size ());
+}
+
+
+static float SparseAxpyAVX512 (float *weights, const SparseVectorView &x,
+  float scalar, float scale)
+{
+  if (x.values ())
+    return AxpyAVX512 (weights, x.ids (), FloatValues (x.values ()), x.size (),
+      scalar, scale);
+  if (x.counts ())
+    return AxpyAVX512 (weights, x.ids (), CountValues (x.counts ()), x.size (),
+      scalar, scale);
+  return AxpyAVX512 (weights, x.ids (), BinaryValues (), x.size (), scalar,
+    scale);
+}
+#endif
+
+float (*SparseDot) (const float *weights, const SparseVectorView &x)
+  = SparseDotScalar;
+float (*SparseAxpy) (float *weights, const SparseVectorView &x,
+  float scalar, float scale) = SparseAxpyScalar;
+static KernelSet g_kernels = kKernelsScalar;
+
+
+bool SelectKernels (KernelSet set)
+{
+#ifdef SOL_X86_KERNELS
+  __builtin_cpu_init ();
+  bool avx2   = __builtin_cpu_supports ("avx2") 
+    && __builtin_cpu_supports ("fma");
+  bool avx512 = __builtin_cpu_supports ("avx512f");
+#else
+  bool avx2   = false;
+  bool avx512 = false;
+#endif
+  if (set == kKernelsAuto)
+    set = avx2 ? kKernelsAVX2 : kKernelsScalar;
+  if (((set == kKernelsAVX2) && !avx2) || ((set == kKernelsAVX512) && !avx512))
+    return false;
+  switch (set)
+  {
+#ifdef SOL_X86_KERNELS
+    case kKernelsAVX512:
+      SparseDot  = SparseDotAVX512;
+      SparseAxpy = SparseAxpyAVX512;
+      break;
+    case kKernelsAVX2:
+      SparseDot  = SparseDotAVX2;
+      SparseAxpy = SparseAxpyAVX2;
+      break;
+#endif
+    default:
+      SparseDot  = SparseDotScalar;
+      SparseAxpy = SparseAxpyScalar;
+      break;
+  }
+  g_kernels = set;
+  return true;
+}
+
+
+KernelSet SelectedKernels ()
+{
+  return g_kernels;
+}
+
+
+const char *KernelSetName (KernelSet set)
+{
+  switch (set)
+  {
+    case kKernelsAuto:   return "auto";
+    case kKernelsAVX2:   return "avx2";
+    case kKernelsAVX512: return "avx512";
+    default:             return "scalar";
+  }
+}
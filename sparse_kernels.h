@@ -0,0 +1,56 @@
+// Header file for SIMD kernels on sparse instances
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef SPARSE_KERNELS_H
+#define SPARSE_KERNELS_H
+
+#include "common.h"
+#include "sparse_vector_view.h"
+
+
+// Kernels for dense weights and sparse instances with strictly increasing
+// ids, so scattered stores never conflict. The instruction set is selected
+// at runtime, scalar kernels compute exactly like the loops they replace.
+// Each kernel has variants for float values, byte counts and binary
+// features, which only sum or add weights.
+typedef enum
+{
+  kKernelsAuto,                       // AVX2 if supported, else scalar
+  kKernelsScalar,                     // Portable loops
+  kKernelsAVX2,                       // 8 lanes, gathers
+  kKernelsAVX512                      // 16 lanes, gathers and scatters
+} KernelSet;
+
+bool      SelectKernels (KernelSet set);  // False if set is not supported
+KernelSet SelectedKernels ();             // Set in use, never kKernelsAuto
+const char *KernelSetName (KernelSet set);
+
+// Sum of weights[x.id (i)] * x.value (i)
+extern float (*SparseDot) (const float *weights, const SparseVectorView &x);
+
+// Add scalar * x.value (i) / scale to weights[x.id (i)], return the sum of
+// x.value (i) times the weights before the update
+extern float (*SparseAxpy) (float *weights, const SparseVectorView &x,
+  float scalar, float scale);
+
+#endif
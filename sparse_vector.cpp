@@ -33,17 +33,17 @@ SparseVector::SparseVector ()
 float SparseVector::InnerProduct (const SparseVector &rhs) const
 {
   float result = 0;
-  const_iterator left  = begin ();
-  const_iterator right = rhs.begin ();
-  while ((left != end ()) && (right != rhs.end ()))
+  int left  = 0;
+  int right = 0;
+  while ((left < size ()) && (right < rhs.size ()))
   {
-    if (left->first < right->first)
+    if (id (left) < rhs.id (right))
       ++left;
-    else if (left->first > right->first)
+    else if (id (left) > rhs.id (right))
       ++right;
     else
     {
-      result += left->second * right->second;
+      result += value (left) * rhs.value (right);
       ++left;
       ++right;
     }
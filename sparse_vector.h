@@ -32,12 +32,12 @@
 
 // TODO: if we define SparseVector as a template<Id, Value> we would
 // TODO: become independent of id_t and common.h 
+// Values are only stored once a component is not 1, so binary features
+// need no values.
 class SparseVector
 {
   public:
     typedef std::pair<id_t, float> elem_t;
-    typedef std::vector<elem_t>::const_iterator  const_iterator;
-    typedef std::vector<elem_t>::const_reference const_reference;
 
     SparseVector ();
     float target () const;                // Get target value
@@ -45,12 +45,16 @@ class SparseVector
     float squaredL2Norm () const;         // Get squared L2-norm
     int   size () const;                  // Get vector size
     id_t  max_id () const;                // Get maximum id
+    id_t  id (int index) const;           // Get id of component
+    float value (int index) const;        // Get value of component
     void  push_back (const elem_t &elem); // Append component
+    void  clear ();                       // Remove all components
     float InnerProduct (const SparseVector &rhs) const; // inner product
-    const_iterator begin () const;        // Iterator
-    const_iterator end () const;          // Iterator
+    const id_t  *ids () const;            // Pointer to ids
+    const float *values () const;         // Pointer to values or NULL
   private:
-    std::vector<elem_t> vector_; // Vector data
+    std::vector<id_t>  ids_;     // Component ids
+    std::vector<float> values_;  // Component values or empty if all 1
     float target_;               // Target value
     float squaredL2Norm_;        // Squared L2-norm
     id_t  max_id_;               // Maximum id in vector
@@ -77,7 +81,7 @@ inline float SparseVector::squaredL2Norm () const
 
 inline int SparseVector::size () const
 {
-  return vector_.size ();
+  return ids_.size ();
 }
 
 
@@ -87,25 +91,52 @@ inline id_t SparseVector::max_id () const
 }
 
 
+inline id_t SparseVector::id (int index) const
+{
+  return ids_[index];
+}
+
+
+inline float SparseVector::value (int index) const
+{
+  return values_.empty () ? 1 : values_[index];
+}
+
+
 inline void SparseVector::push_back (const SparseVector::elem_t &elem)
 {
   // TODO: ensure increasing ids 
-  vector_.push_back (elem);
+  if (!values_.empty () || (elem.second != 1))
+  {
+    values_.resize (ids_.size (), 1);
+    values_.push_back (elem.second);
+  }
+  ids_.push_back (elem.first);
   squaredL2Norm_ += elem.second * elem.second;
   if (elem.first > max_id_)
     max_id_ = elem.first;
 }
 
 
-inline SparseVector::const_iterator SparseVector::begin () const
+inline void SparseVector::clear ()
+{
+  ids_.clear ();
+  values_.clear ();
+  target_        = 0;
+  squaredL2Norm_ = 0;
+  max_id_        = 0;
+}
+
+
+inline const id_t *SparseVector::ids () const
 {
-  return vector_.begin ();
-} 
+  return ids_.empty () ? NULL : &ids_[0];
+}
 
 
-inline SparseVector::const_iterator SparseVector::end () const
+inline const float *SparseVector::values () const
 {
-  return vector_.end ();
+  return values_.empty () ? NULL : &values_[0];
 }
 
 
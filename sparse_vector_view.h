@@ -0,0 +1,131 @@
+// Read-only view on sparse vectors
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef SPARSE_VECTOR_VIEW_H
+#define SPARSE_VECTOR_VIEW_H
+
+#include <stdint.h>
+
+#include "common.h"
+#include "sparse_vector.h"
+
+
+// Non-owning view on the components of a sparse vector. Views are cheap
+// to copy and stay valid as long as the underlying storage is unchanged.
+// Values are floats, counts stored as bytes or, if both are NULL, 1 for
+// all components of binary features.
+class SparseVectorView
+{
+  public:
+    SparseVectorView (const id_t *ids, const float *values, int size,
+      float target, float squaredL2Norm, const uint8_t *counts = NULL);
+    SparseVectorView (const SparseVector &vector);
+    float target () const;                // Get target value
+    float squaredL2Norm () const;         // Get squared L2-norm
+    int   size () const;                  // Get vector size
+    id_t  id (int index) const;           // Get id of component
+    float value (int index) const;        // Get value of component
+    const id_t  *ids () const;            // Pointer to ids
+    const float *values () const;         // Pointer to values or NULL
+    const uint8_t *counts () const;       // Pointer to counts or NULL
+  private:
+    const id_t  *ids_;           // Component ids
+    const float *values_;        // Component values or NULL
+    const uint8_t *counts_;      // Integer values or NULL
+    int   size_;                 // Number of components
+    float target_;               // Target value
+    float squaredL2Norm_;        // Squared L2-norm
+};
+
+
+inline SparseVectorView::SparseVectorView (const id_t *ids,
+  const float *values, int size, float target, float squaredL2Norm,
+  const uint8_t *counts)
+: ids_(ids)
+, values_(values)
+, counts_(counts)
+, size_(size)
+, target_(target)
+, squaredL2Norm_(squaredL2Norm)
+{}
+
+
+inline SparseVectorView::SparseVectorView (const SparseVector &vector)
+: ids_(vector.ids ())
+, values_(vector.values ())
+, counts_(NULL)
+, size_(vector.size ())
+, target_(vector.target ())
+, squaredL2Norm_(vector.squaredL2Norm ())
+{}
+
+
+inline float SparseVectorView::target () const
+{
+  return target_;
+}
+
+
+inline float SparseVectorView::squaredL2Norm () const
+{
+  return squaredL2Norm_;
+}
+
+
+inline int SparseVectorView::size () const
+{
+  return size_;
+}
+
+
+inline id_t SparseVectorView::id (int index) const
+{
+  return ids_[index];
+}
+
+
+inline float SparseVectorView::value (int index) const
+{
+  if (values_)
+    return values_[index];
+  return counts_ ? counts_[index] : 1;
+}
+
+
+inline const id_t *SparseVectorView::ids () const
+{
+  return ids_;
+}
+
+
+inline const float *SparseVectorView::values () const
+{
+  return values_;
+}
+
+
+inline const uint8_t *SparseVectorView::counts () const
+{
+  return counts_;
+}
+
+#endif
@@ -0,0 +1,173 @@
+// Implementation of synthetic data generator
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cmath>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#include "synthetic_data.h"
+#include "text_writer.h"
+
+
+std::istream& operator>> (std::istream& in,
+  SyntheticData::Distribution& distribution)
+{
+  std::string token;
+  in >> token;
+  if (token == "uniform")
+    distribution = SyntheticData::kIdsUniform;
+  else if (token == "zipf")
+    distribution = SyntheticData::kIdsZipf;
+  return in;
+}
+
+
+std::istream& operator>> (std::istream& in, SyntheticData::Targets& targets)
+{
+  std::string token;
+  in >> token;
+  if (token == "binary")
+    targets = SyntheticData::kTargetsBinary;
+  else if (token == "multiclass")
+    targets = SyntheticData::kTargetsMultiClass;
+  else if (token == "multilabel")
+    targets = SyntheticData::kTargetsMultiLabel;
+  return in;
+}
+
+
+SyntheticData::SyntheticData (int num_features, int density,
+  Distribution distribution, double exponent, uint64_t seed)
+: num_features_(num_features)
+, density_(density)
+, distribution_(distribution)
+, seed_(seed)
+, random_(seed)
+{
+  if (distribution_ != kIdsZipf)
+    return;
+  cdf_.resize (num_features_);
+  double sum = 0;
+  for (int k = 0; k < num_features_; ++k)
+  {
+    sum += pow (k + 1.0, -exponent);
+    cdf_[k] = sum;
+  }
+  for (int k = 0; k < num_features_; ++k)
+    cdf_[k] /= sum;
+}
+
+
+bool SyntheticData::Write (const char *file_name, size_t num_instances,
+  Targets targets, int num_classes)
+{
+  std::ofstream ofs (file_name);
+  Write (ofs, num_instances, targets, num_classes);
+  ofs.close ();
+  return !ofs.fail ();
+}
+
+
+// Write num_instances lines. The target of an instance depends on the
+// scores of num_classes hidden submodels (one for binary targets): the
+// sign for binary, the highest score for multi-class and the positive
+// scores for multi-label targets.
+void SyntheticData::Write (std::ostream &out, size_t num_instances,
+  Targets targets, int num_classes)
+{
+  int num_submodels = (targets == kTargetsBinary) ? 1 : num_classes;
+  std::vector<id_t>  ids;
+  std::vector<float> values;
+  std::vector<float> scores (num_submodels);
+  TextWriter writer (out);
+  for (size_t i = 0; i < num_instances; ++i)
+  {
+    Draw (ids, values);
+
+    // Target
+    scores.assign (num_submodels, 0);
+    for (int j = 0; j < num_submodels; ++j)
+    {
+      for (size_t k = 0; k < ids.size (); ++k)
+        scores[j] += HiddenWeight (j, ids[k]) * values[k];
+    }
+    int target = 0;
+    if (targets == kTargetsBinary)
+      target = (scores[0] > 0) ? 1 : -1;
+    else if (targets == kTargetsMultiClass)
+      target = std::max_element (scores.begin (), scores.end ())
+        - scores.begin ();
+    else
+    {
+      for (int j = 0; j < num_submodels; ++j)
+        target |= (scores[j] > 0) << j;
+    }
+
+    writer.Put (target);
+    for (size_t k = 0; k < ids.size (); ++k)
+    {
+      writer.Put (' ');
+      writer.Put (int (ids[k]));
+      writer.Put (':');
+      writer.Put (values[k]);
+    }
+    writer.Put ('\n');
+  }
+}
+
+
+// Draw distinct ids in increasing order and their values
+void SyntheticData::Draw (std::vector<id_t> &ids, std::vector<float> &values)
+{
+  ids.clear ();
+  for (int k = 0; k < density_; ++k)
+    ids.push_back (DrawId ());
+  std::sort (ids.begin (), ids.end ());
+  ids.erase (std::unique (ids.begin (), ids.end ()), ids.end ());
+  values.resize (ids.size ());
+  for (size_t k = 0; k < ids.size (); ++k)
+    values[k] = float (random_.Uniform (1000) + 1) / 1000;
+}
+
+
+id_t SyntheticData::DrawId ()
+{
+  if (distribution_ == kIdsUniform)
+    return random_.Uniform (num_features_) + 1;
+  double u = (random_.Next () >> 11) * (1.0 / 9007199254740992.0);
+  return std::upper_bound (cdf_.begin (), cdf_.end () - 1, u)
+    - cdf_.begin () + 1;
+}
+
+
+// Weight of the hidden model from a hash of submodel and id (splitmix64
+// finalizer), so no weights need to be stored
+float SyntheticData::HiddenWeight (int submodel, id_t id) const
+{
+  uint64_t h = seed_ ^ ((uint64_t (submodel) << 32) | id);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return float (h >> 40) / float (1 << 23) - 1;
+}
@@ -0,0 +1,76 @@
+// Header file for synthetic data generator
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef SYNTHETIC_DATA_H
+#define SYNTHETIC_DATA_H
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include <stdint.h>
+
+#include "common.h"
+#include "sampler.h"
+
+
+// Generator of random instances in sparse data format. Each instance has
+// about density distinct features with ids in 1 ... num_features, drawn
+// uniformly or from a Zipf distribution where id k has probability
+// proportional to k^-exponent, and values in (0, 1]. Labels are given by a
+// hidden random linear model, so the data can be learned.
+class SyntheticData
+{
+  public:
+    typedef enum { kIdsUniform, kIdsZipf } Distribution; // Feature ids
+    typedef enum
+    {
+      kTargetsBinary,                 // -1 or 1
+      kTargetsMultiClass,             // Class in 0 ... num_classes - 1
+      kTargetsMultiLabel              // Bits of num_classes labels
+    } Targets;
+    SyntheticData (int num_features, int density, Distribution distribution,
+      double exponent, uint64_t seed);
+    bool Write (const char *file_name, size_t num_instances,
+      Targets targets, int num_classes);    // Write instances to file
+    void Write (std::ostream &out, size_t num_instances, Targets targets,
+      int num_classes);                     // Write instances to stream
+    void Draw (std::vector<id_t> &ids,
+      std::vector<float> &values);          // Features of one instance
+  private:
+    id_t  DrawId ();                  // Random feature id
+    float HiddenWeight (int submodel, id_t id) const; // Weight in [-1, 1)
+
+    int   num_features_;              // Largest feature id
+    int   density_;                   // Features drawn per instance
+    Distribution distribution_;       // Distribution of feature ids
+    std::vector<double> cdf_;         // Cumulative probabilities (Zipf)
+    uint64_t seed_;                   // Seed of hidden model
+    RandomEngine random_;             // Random number generator
+};
+
+std::istream& operator>> (std::istream& in,
+  SyntheticData::Distribution& distribution);
+std::istream& operator>> (std::istream& in,
+  SyntheticData::Targets& targets);
+
+#endif
@@ -0,0 +1,99 @@
+// Buffered text output
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef TEXT_WRITER_H
+#define TEXT_WRITER_H
+
+#include <charconv>
+#include <ostream>
+
+
+// Buffered writer for text output of models and predictions. Numbers are
+// formatted by to_chars, which is independent of the locale and gives the
+// same output as ostream's default formatting.
+class TextWriter
+{
+  public:
+    TextWriter (std::ostream &os);
+    ~TextWriter ();
+    void Put (char c);
+    void Put (int value);
+    void Put (float value);
+    void Flush ();                    // Write buffer to stream
+  private:
+    void Reserve (int length);        // Flush if less space left
+    static const int kBufSize = 1 << 16;
+    std::ostream &os_;
+    char buffer_[kBufSize];
+    int  length_;
+};
+
+
+inline TextWriter::TextWriter (std::ostream &os)
+: os_(os)
+, length_(0)
+{}
+
+
+inline TextWriter::~TextWriter ()
+{
+  Flush ();
+}
+
+
+inline void TextWriter::Flush ()
+{
+  os_.write (buffer_, length_);
+  length_ = 0;
+}
+
+
+inline void TextWriter::Reserve (int length)
+{
+  if (length_ + length > kBufSize)
+    Flush ();
+}
+
+
+inline void TextWriter::Put (char c)
+{
+  Reserve (1);
+  buffer_[length_++] = c;
+}
+
+
+inline void TextWriter::Put (int value)
+{
+  Reserve (16);
+  length_ = std::to_chars (buffer_ + length_, buffer_ + kBufSize, value).ptr
+    - buffer_;
+}
+
+
+inline void TextWriter::Put (float value)
+{
+  Reserve (32);
+  length_ = std::to_chars (buffer_ + length_, buffer_ + kBufSize, value,
+    std::chars_format::general, 6).ptr - buffer_;
+}
+
+#endif
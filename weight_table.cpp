@@ -0,0 +1,88 @@
+// Implementation of hash tables of sparse weights
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "weight_table.h"
+
+
+// Initial number of slots, a power of two
+const int kInitialCapacity = 16;
+
+
+WeightTable::WeightTable ()
+: size_(0)
+, shift_(32 - 4)
+, tracks_l1_(false)
+{
+  Slot empty = { kEmpty, 0 };
+  slots_.assign (kInitialCapacity, empty);
+}
+
+
+void WeightTable::TrackL1 (double l1_applied)
+{
+  l1_applied_.assign (capacity (), l1_applied);
+  tracks_l1_ = true;
+}
+
+
+void WeightTable::clear ()
+{
+  Slot empty = { kEmpty, 0 };
+  slots_.assign (kInitialCapacity, empty);
+  if (tracks_l1_)
+    l1_applied_.assign (kInitialCapacity, 0);
+  std::vector<Slot> (slots_).swap (slots_);
+  std::vector<double> (l1_applied_).swap (l1_applied_);
+  size_  = 0;
+  shift_ = 32 - 4;
+}
+
+
+size_t WeightTable::memory_usage () const
+{
+  return slots_.capacity () * sizeof (Slot)
+    + l1_applied_.capacity () * sizeof (double);
+}
+
+
+void WeightTable::Grow ()
+{
+  Slot empty = { kEmpty, 0 };
+  std::vector<Slot>   slots (2 * capacity (), empty);
+  std::vector<double> l1_applied (tracks_l1_ ? 2 * capacity () : 0, 0);
+  slots.swap (slots_);
+  l1_applied.swap (l1_applied_);
+  --shift_;
+
+  int mask = capacity () - 1;
+  for (size_t old_slot = 0; old_slot < slots.size (); ++old_slot)
+  {
+    if (slots[old_slot].id == kEmpty)
+      continue;
+    int slot = HomeSlot (slots[old_slot].id);
+    while (slots_[slot].id != kEmpty)
+      slot = (slot + 1) & mask;
+    slots_[slot] = slots[old_slot];
+    if (tracks_l1_)
+      l1_applied_[slot] = l1_applied[old_slot];
+  }
+}
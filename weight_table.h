@@ -0,0 +1,168 @@
+// Header for hash tables of sparse weights
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef WEIGHT_TABLE_H
+#define WEIGHT_TABLE_H
+
+#include <cstddef>
+#include <vector>
+
+#include <stdint.h>
+
+#include "common.h"
+
+
+// Open addressing hash table from feature ids to weights with linear
+// probing, used by WeightVector for sparse storage. Ids and weights
+// share a slot, so a lookup usually touches one cache line. Entries are
+// never removed and empty slots have weight 0, so the weight at Probe (id)
+// is the weight of id without a branch on whether id is present. Once L1
+// tracking is enabled, each slot also holds the L1 penalty applied to its
+// weight. kEmpty itself is not a valid id; WeightVector indices are ints
+// and the learner rejects feature ids of INT_MAX or more.
+class WeightTable
+{
+  public:
+    static const id_t kEmpty = id_t (-1); // Id of unused slots
+    WeightTable ();
+    int    capacity () const;             // Number of slots
+    int    size () const;                 // Number of used slots
+    id_t   id (int slot) const;           // Id in slot or kEmpty
+    float  weight (int slot) const;
+    float &weight (int slot);
+    bool   tracks_l1 () const;            // L1 penalties are stored
+    double l1_applied (int slot) const;
+    double &l1_applied (int slot);
+    int    Probe (id_t id) const;         // Slot of id or an empty slot
+    int    Find (id_t id) const;          // Slot of id or -1
+    int    Insert (id_t id, double l1_applied); // Slot of id, new ids
+                                          // get weight 0
+    void   TrackL1 (double l1_applied);   // Store L1 penalties from now
+    void   clear ();                      // Remove all entries
+    size_t memory_usage () const;         // Bytes used
+  private:
+    typedef struct { id_t id; float weight; } Slot;
+    int  HomeSlot (id_t id) const;        // First slot probed for id
+    void Grow ();                         // Double capacity and rehash
+
+    std::vector<Slot>   slots_;           // Ids and weights
+    std::vector<double> l1_applied_;      // L1 penalties by slot or empty
+    int  size_;                           // Number of used slots
+    int  shift_;                          // 32 - log2 (capacity)
+    bool tracks_l1_;                      // L1 penalties are stored
+};
+
+
+inline int WeightTable::capacity () const
+{
+  return slots_.size ();
+}
+
+
+inline int WeightTable::size () const
+{
+  return size_;
+}
+
+
+inline id_t WeightTable::id (int slot) const
+{
+  return slots_[slot].id;
+}
+
+
+inline float WeightTable::weight (int slot) const
+{
+  return slots_[slot].weight;
+}
+
+
+inline float &WeightTable::weight (int slot)
+{
+  return slots_[slot].weight;
+}
+
+
+inline bool WeightTable::tracks_l1 () const
+{
+  return tracks_l1_;
+}
+
+
+inline double WeightTable::l1_applied (int slot) const
+{
+  return l1_applied_[slot];
+}
+
+
+inline double &WeightTable::l1_applied (int slot)
+{
+  return l1_applied_[slot];
+}
+
+
+// Fibonacci hashing, i.e. the high bits of id * 2^32 / golden ratio
+inline int WeightTable::HomeSlot (id_t id) const
+{
+  return uint32_t (id * 2654435769u) >> shift_;
+}
+
+
+inline int WeightTable::Probe (id_t id) const
+{
+  int mask = capacity () - 1;
+  int slot = HomeSlot (id);
+  while ((slots_[slot].id != id) & (slots_[slot].id != kEmpty))
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+
+inline int WeightTable::Find (id_t id) const
+{
+  int slot = Probe (id);
+  return (slots_[slot].id == id) ? slot : -1;
+}
+
+
+inline int WeightTable::Insert (id_t id, double l1_applied)
+{
+  // Keep load factor at most 0.5, longer probe sequences cost more in
+  // mispredicted branches than the memory saved
+  if (2 * (size_ + 1) > capacity ())
+    Grow ();
+  int mask = capacity () - 1;
+  int slot = HomeSlot (id);
+  for (; slots_[slot].id != kEmpty; slot = (slot + 1) & mask)
+  {
+    if (slots_[slot].id == id)
+      return slot;
+  }
+  slots_[slot].id     = id;
+  slots_[slot].weight = 0;
+  if (tracks_l1_)
+    l1_applied_[slot] = l1_applied;
+  ++size_;
+  return slot;
+}
+
+#endif
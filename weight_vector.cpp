@@ -23,86 +23,712 @@
 #include <cstdlib>
 #include <cstring>
 
-#include "sparse_vector.h"
+#include <algorithm>
+#include <utility>
+
+#include "sparse_kernels.h"
+#include "sparse_vector_view.h"
 #include "weight_vector.h"
 
 
-WeightVector::WeightVector (int size)
+const float WeightVector::kMinScale        = 1e-10;
+const float WeightVector::kMinScaleFloat16 = 1.0 / 256;
+const float WeightVector::kMaxFloat16      = 65504;
+const uint64_t kRoundingSeed = 1;     // Seed of stochastic rounding
+
+
+// Precision applies to dense storage only, sparse weights are floats.
+// Vectors updated at the same time need different seeds, so their
+// rounding errors are independent.
+WeightVector::WeightVector (int size, Storage storage, Precision precision,
+  uint64_t seed)
   :size_(size)
   ,bias_(0)
   ,squaredL2Norm_(0)
+  ,norm_stale_(false)
+  ,norm_updates_(0)
   ,scale_(1.0)
+  ,l1_penalty_(0)
+  ,l1_applied_(NULL)
+  ,table_(NULL)
+  ,checkpoint_(NULL)
+  ,changes_(NULL)
+  ,all_changed_(false)
+  ,vector_(NULL)
+  ,reduced_(NULL)
+  ,precision_(kFloat32)
+  ,rounding_(kRoundingSeed + seed)
+  ,num_clamped_(0)
 {
+  owns_vector_ = true;
+  stride_ = 1;
+  if (storage == kSparse)
+  {
+    table_  = new WeightTable;
+    return;
+  }
+  if (precision != kFloat32)
+  {
+    precision_ = precision;
+    reduced_   = new uint16_t[size_];
+    memset (reduced_, 0, size_ * sizeof (uint16_t));
+    return;
+  }
   vector_ = new float[size_];
   memset (vector_, 0, size_ * sizeof (float));
 }
 
 
+// Use size weights at vector, stride floats apart, as storage without
+// copying them. The norm is computed when it is needed.
+WeightVector::WeightVector (int size, float *vector, int stride)
+  :size_(size)
+  ,bias_(0)
+  ,squaredL2Norm_(0)
+  ,norm_stale_(true)
+  ,norm_updates_(0)
+  ,scale_(1.0)
+  ,l1_penalty_(0)
+  ,l1_applied_(NULL)
+  ,table_(NULL)
+  ,checkpoint_(NULL)
+  ,changes_(NULL)
+  ,all_changed_(false)
+  ,vector_(vector)
+  ,reduced_(NULL)
+  ,precision_(kFloat32)
+  ,rounding_(kRoundingSeed)
+  ,owns_vector_(false)
+  ,stride_(stride)
+  ,num_clamped_(0)
+{
+}
+
+
 WeightVector::WeightVector (const WeightVector &copy)
+  :rounding_(copy.rounding_)
 {
   size_          = copy.size_;
   bias_          = copy.bias_;
   scale_         = copy.scale_;
   squaredL2Norm_ = copy.squaredL2Norm_;
-  vector_        = new float[size_];
-  memcpy (vector_, copy.vector_, size_* sizeof (float));
+  norm_stale_    = copy.norm_stale_;
+  norm_updates_  = copy.norm_updates_;
+  owns_vector_   = true;
+  stride_        = 1;
+  l1_penalty_    = copy.l1_penalty_;
+  l1_applied_    = NULL;
+  table_         = NULL;
+  checkpoint_    = NULL;
+  changes_       = NULL;
+  all_changed_   = false;
+  vector_        = NULL;
+  reduced_       = NULL;
+  precision_     = copy.precision_;
+  num_clamped_   = copy.num_clamped_;
+  if (copy.table_)
+  {
+    table_ = new WeightTable (*copy.table_);
+    return;
+  }
+  if (copy.reduced_)
+  {
+    reduced_ = new uint16_t[size_];
+    memcpy (reduced_, copy.reduced_, size_ * sizeof (uint16_t));
+  }
+  else
+  {
+    vector_ = new float[size_];
+    for (int i = 0; i < size_; ++i)
+      vector_[i] = copy.vector_[i * copy.stride_];
+  }
+  if (copy.l1_applied_)
+  {
+    l1_applied_ = new double[size_];
+    memcpy (l1_applied_, copy.l1_applied_, size_ * sizeof (double));
+  }
+}
+
+
+// Copy weights and state of copy, but not its checkpoint. Storage is
+// reused if this vector was copied from one of the same size, storage
+// and precision, so repeated copies allocate no memory.
+void WeightVector::Assign (const WeightVector &copy)
+{
+  if (!owns_vector_ || (size_ != copy.size_) || (!table_ != !copy.table_)
+    || (precision_ != copy.precision_))
+  {
+    if (owns_vector_)
+      delete[] vector_;
+    delete[] reduced_;
+    delete[] l1_applied_;
+    delete table_;
+    owns_vector_ = true;
+    stride_      = 1;
+    size_        = copy.size_;
+    precision_   = copy.precision_;
+    l1_applied_  = NULL;
+    table_       = copy.table_ ? new WeightTable : NULL;
+    vector_      = (copy.table_ || copy.reduced_) ? NULL : new float[size_];
+    reduced_     = copy.reduced_ ? new uint16_t[size_] : NULL;
+  }
+  bias_          = copy.bias_;
+  scale_         = copy.scale_;
+  squaredL2Norm_ = copy.squaredL2Norm_;
+  norm_stale_    = copy.norm_stale_;
+  norm_updates_  = copy.norm_updates_;
+  l1_penalty_    = copy.l1_penalty_;
+  ReleaseCheckpoint ();
+  if (copy.table_)
+  {
+    *table_ = *copy.table_;
+    return;
+  }
+  if (copy.reduced_)
+    memcpy (reduced_, copy.reduced_, size_ * sizeof (uint16_t));
+  else if (copy.stride_ == 1)
+    memcpy (vector_, copy.vector_, size_ * sizeof (float));
+  else
+  {
+    for (int i = 0; i < size_; ++i)
+      vector_[i] = copy.vector_[i * copy.stride_];
+  }
+  if (!copy.l1_applied_)
+  {
+    delete[] l1_applied_;
+    l1_applied_ = NULL;
+    return;
+  }
+  if (!l1_applied_)
+    l1_applied_ = new double[size_];
+  memcpy (l1_applied_, copy.l1_applied_, size_ * sizeof (double));
 }
 
 
 WeightVector::~WeightVector ()
 {
-  delete[] vector_;
+  if (owns_vector_)
+    delete[] vector_;
+  delete[] reduced_;
+  delete[] l1_applied_;
+  delete table_;
+  delete checkpoint_;
+  delete changes_;
 }
 
 
-void WeightVector::PlusEquals (const SparseVector &rhs)
+void WeightVector::PlusEquals (const SparseVectorView &rhs)
 {
-  float accum = 0;
-  for (SparseVector::const_iterator i = rhs.begin (); 
-    i != rhs.end (); ++i)
+  PlusEquals (1.0, rhs);
+}
+
+
+// The norm changes by scalar * (scalar * |rhs|^2 + 2 <w, rhs>). Rounded
+// 16 bit weights change it by the difference of their squares instead.
+void WeightVector::PlusEquals (float scalar, const SparseVectorView &rhs)
+{
+  float  accum  = 0;
+  double change = 0;                  // Of squared stored weights (16 bit)
+  if (checkpoint_)
+    SaveWeights (rhs);
+  if (changes_)
+    RecordChanges (rhs);
+  if (table_)
+  {
+    for (int i = 0; i < rhs.size (); ++i)
+    {
+      int slot = table_->Insert (rhs.id (i), l1_penalty_);
+      float &weight = table_->weight (slot);
+      if (table_->tracks_l1 ())
+      {
+        weight = SlotWeight (slot) / scale_;
+        table_->l1_applied (slot) = l1_penalty_;
+      }
+      accum  += rhs.value (i) * weight;
+      weight += scalar * rhs.value (i) / scale_;
+    }
+  }
+  else if ((stride_ == 1) && !l1_applied_ && !reduced_)
+    accum = SparseAxpy (vector_, rhs, scalar, scale_);
+  else
   {
-    accum += i->second * vector_[i->first]; 
-    vector_[i->first] += i->second / scale_;
+    // Lazy L1 penalties are applied before the update
+    for (int i = 0; i < rhs.size (); ++i)
+    {
+      int   index  = rhs.id (i);
+      float weight = StoredWeight (index);
+      if (l1_applied_)
+      {
+        weight = GetWeight (index) / scale_;
+        l1_applied_[index] = l1_penalty_;
+      }
+      accum += rhs.value (i) * weight;
+      UpdateWeight (index, weight + scalar * rhs.value (i) / scale_);
+      if (reduced_)
+      {
+        float stored = StoredWeight (index);
+        change += double (stored) * stored - double (weight) * weight;
+      }
+    }
+  }
+  if (!norm_stale_)
+  {
+    if (reduced_)
+      squaredL2Norm_ += double (scale_) * scale_ * change;
+    else
+      squaredL2Norm_ += scalar *
+        (scalar * rhs.squaredL2Norm () + 2 * scale_ * accum);
+    CountNormUpdates (rhs.size ());
   }
-  squaredL2Norm_ += rhs.squaredL2Norm () - 2 * scale_ * accum;
 }
 
 
-void WeightVector::PlusEquals (float scalar, const SparseVector &rhs)
+float WeightVector::InnerProduct (const SparseVectorView &rhs) const
 {
-  float accum = 0;
-  for (SparseVector::const_iterator i = rhs.begin (); 
-    i != rhs.end (); ++i)
+  if (table_ && !table_->tracks_l1 ())
+  {
+    float ip = 0;
+    for (int i = 0; i < rhs.size (); ++i)
+      ip += table_->weight (table_->Probe (rhs.id (i))) * rhs.value (i);
+    return scale_ * ip;
+  }
+  if (lazy_l1 ())
   {
-    accum += i->second * vector_[i->first]; 
-    vector_[i->first] += scalar * i->second / scale_;
+    float ip = 0;
+    for (int i = 0; i < rhs.size (); ++i)
+      ip += GetWeight (rhs.id (i)) * rhs.value (i);
+    return ip;
   }
-  squaredL2Norm_ += scalar *
-    (scalar * rhs.squaredL2Norm () - 2 * scale_ * accum);
+  if (reduced_)
+    return scale_ * ReducedDot (rhs);
+  if (stride_ == 1)
+    return scale_ * SparseDot (vector_, rhs);
+
+  float ip = 0;
+  for (int i = 0; i < rhs.size (); ++i)
+  {
+    ip += vector_[rhs.id (i) * stride_] * rhs.value (i);
+  }
+  return scale_ * ip;
 }
 
 
-float WeightVector::InnerProduct (const SparseVector &rhs) const
+// Inner product with the 16 bit stored weights. The conversion of fp16
+// weights takes many instructions, so they are gathered first: the loop
+// with the cache misses is short and many of them are in flight at once.
+float WeightVector::ReducedDot (const SparseVectorView &rhs) const
 {
   float ip = 0;
-  for (SparseVector::const_iterator i = rhs.begin ();
-    i != rhs.end (); ++i)
+  if (precision_ == kBFloat16)
   {
-    ip += vector_[i->first] * i->second;
+    for (int i = 0; i < rhs.size (); ++i)
+      ip += bf16_to_float (reduced_[rhs.id (i)]) * rhs.value (i);
+    return ip;
   }
-  return scale_ * ip;
+  const int kBlockSize = 64;
+  uint16_t weights[kBlockSize];
+  for (int begin = 0; begin < rhs.size (); begin += kBlockSize)
+  {
+    int size = std::min (kBlockSize, rhs.size () - begin);
+    const id_t *ids = rhs.ids () + begin;
+    for (int i = 0; i < size; ++i)
+      weights[i] = reduced_[ids[i]];
+    for (int i = 0; i < size; ++i)
+      ip += fp16_to_float (weights[i]) * rhs.value (begin + i);
+  }
+  return ip;
+}
+
+
+// Return the smallest index >= index of a non-zero stored weight or
+// size () if there is none. Zero blocks are skipped by a loop the
+// compiler can vectorize.
+int WeightVector::NextNonZero (int index) const
+{
+  if (reduced_)
+  {
+    while ((index < size_) && !(reduced_[index] & 0x7fff))
+      ++index;
+    return index;
+  }
+  if (stride_ != 1)
+  {
+    while ((index < size_) && (vector_[index * stride_] == 0))
+      ++index;
+    return index;
+  }
+  const int kBlockSize = 16;
+  while ((index < size_) && (index % kBlockSize))
+  {
+    if (vector_[index] != 0)
+      return index;
+    ++index;
+  }
+  while (index + kBlockSize <= size_)
+  {
+    bool non_zero = false;
+    for (int i = index; i < index + kBlockSize; ++i)
+      non_zero |= (vector_[i] != 0);
+    if (non_zero)
+      break;
+    index += kBlockSize;
+  }
+  while ((index < size_) && (vector_[index] == 0))
+    ++index;
+  return index;
+}
+
+
+// Get ids and values of all non-zero weights in increasing order of ids
+void WeightVector::GetNonZeros (std::vector<id_t> &ids,
+  std::vector<float> &values) const
+{
+  ids.clear ();
+  values.clear ();
+  if (!table_)
+  {
+    for (int i = NextNonZero (0); i < size_; i = NextNonZero (i + 1))
+    {
+      float weight = GetWeight (i);
+      if (weight != 0)
+      {
+        ids.push_back (i);
+        values.push_back (weight);
+      }
+    }
+    return;
+  }
+
+  std::vector<std::pair<id_t, float> > weights;
+  for (int slot = 0; slot < table_->capacity (); ++slot)
+  {
+    if (table_->id (slot) == WeightTable::kEmpty)
+      continue;
+    float weight = SlotWeight (slot);
+    if (weight != 0)
+      weights.push_back (std::make_pair (table_->id (slot), weight));
+  }
+  std::sort (weights.begin (), weights.end ());
+  for (size_t k = 0; k < weights.size (); ++k)
+  {
+    ids.push_back (weights[k].first);
+    values.push_back (weights[k].second);
+  }
+}
+
+
+// Weight in slot of the hash table, with lazy L1 penalty
+float WeightVector::SlotWeight (int slot) const
+{
+  if (table_->tracks_l1 ())
+    return truncate_l1 (scale_ * table_->weight (slot),
+      l1_penalty_ - table_->l1_applied (slot));
+  return scale_ * table_->weight (slot);
+}
+
+
+float WeightVector::GetSparseWeight (int index) const
+{
+  int slot = table_->Find (index);
+  return (slot < 0) ? 0 : SlotWeight (slot);
+}
+
+
+// Zero weights are only stored if the id is already in the table
+void WeightVector::SetSparseWeight (int index, float value)
+{
+  if ((value == 0) && (table_->Find (index) < 0))
+    return;
+  int slot = table_->Insert (index, l1_penalty_);
+  table_->weight (slot) = value / scale_;
+  if (table_->tracks_l1 ())
+    table_->l1_applied (slot) = l1_penalty_;
+}
+
+
+float WeightVector::squaredL2Norm () const
+{
+  if (norm_stale_)
+  {
+    squaredL2Norm_ = SumOfSquares ();
+    norm_stale_    = false;
+    norm_updates_  = 0;
+  }
+  return squaredL2Norm_;
+}
+
+
+// Recompute cached squared L2-norm from all weights
+void WeightVector::ComputeSquaredL2Norm ()
+{
+  squaredL2Norm_ = SumOfSquares ();
+  norm_stale_    = false;
+  norm_updates_  = 0;
+}
+
+
+double WeightVector::SumOfSquares () const
+{
+  double sum = 0;
+  if (table_)
+  {
+    for (int slot = 0; slot < table_->capacity (); ++slot)
+    {
+      if (table_->id (slot) != WeightTable::kEmpty)
+        sum += SlotWeight (slot) * SlotWeight (slot);
+    }
+  }
+  else
+  {
+    for (int i = 0; i < size_; ++i)
+      sum += GetWeight (i) * GetWeight (i);
+  }
+  return sum;
+}
+
+
+// Fold scale_ into the stored weights. Changed weights are saved for the
+// checkpoint like any other change. The products are rounded, so the norm
+// is recomputed when it is read next.
+void WeightVector::Rescale ()
+{
+  if (table_)
+  {
+    for (int slot = 0; slot < table_->capacity (); ++slot)
+    {
+      if (table_->id (slot) == WeightTable::kEmpty)
+        continue;
+      if (checkpoint_)
+        SaveWeight (table_->id (slot));
+      table_->weight (slot) *= scale_;
+    }
+  }
+  else
+  {
+    for (int i = NextNonZero (0); i < size_; i = NextNonZero (i + 1))
+    {
+      if (checkpoint_)
+        SaveWeight (i);
+      StoreWeight (i, StoredWeight (i) * scale_);
+    }
+  }
+  scale_ = 1.0;
+  all_changed_ = (changes_ != NULL);
+  norm_stale_  = true;
+}
+
+
+size_t WeightVector::memory_usage () const
+{
+  if (table_)
+    return table_->memory_usage ();
+  if (reduced_)
+    return size_ * sizeof (uint16_t)
+      + (l1_applied_ ? size_ * sizeof (double) : 0);
+  return (owns_vector_ ? size_ * sizeof (float) : 0)
+    + (l1_applied_ ? size_ * sizeof (double) : 0);
 }
 
 
+// Add factor to the cumulative L1 penalty. Weights are truncated lazily
+// by GetWeight, InnerProduct and PlusEquals (Tsuruoka et al., 2009), so
+// the cost is O(1) instead of O(size) per call. The norm is recomputed
+// when it is read next.
 void WeightVector::RegularizeL1 (const float factor)
 { 
-  for (int i = 0; i < size (); ++i)
-  {
-    float weight = GetWeight (i);
-    weight -= sign (weight) * factor;
-    // Truncate
-    if (abs (weight) < factor)
-      weight = 0;
-    SetWeight (i, weight);
+  norm_stale_ = true;
+  if (table_)
+  {
+    if (!table_->tracks_l1 ())
+      table_->TrackL1 (l1_penalty_);
+  }
+  else if (!l1_applied_)
+  {
+    l1_applied_ = new double[size_];
+    for (int i = 0; i < size_; ++i)
+      l1_applied_[i] = l1_penalty_;
+  }
+  l1_penalty_ += factor;
+}
+
+
+// Start tracking changes from the current state. Changes by PlusEquals,
+// SetWeight and the whole-vector operations are tracked, but not clear ().
+void WeightVector::Checkpoint ()
+{
+  if (!checkpoint_)
+  {
+    checkpoint_ = new WeightCheckpoint;
+    checkpoint_->saved.TrackL1 (0);
+  }
+  else
+    checkpoint_->saved.clear ();
+  checkpoint_->bias          = bias_;
+  checkpoint_->scale         = scale_;
+  checkpoint_->squaredL2Norm = squaredL2Norm_;
+  checkpoint_->norm_stale    = norm_stale_;
+  checkpoint_->l1_penalty    = l1_penalty_;
+}
+
+
+// Write back saved weights and state, the checkpoint is released
+void WeightVector::RestoreCheckpoint ()
+{
+  if (!checkpoint_)
+    return;
+  const WeightTable &saved = checkpoint_->saved;
+  for (int slot = 0; slot < saved.capacity (); ++slot)
+  {
+    id_t index = saved.id (slot);
+    if (index == WeightTable::kEmpty)
+      continue;
+    if (changes_)
+      changes_->Insert (index, 0);
+    if (table_)
+    {
+      int s = table_->Insert (index, saved.l1_applied (slot));
+      table_->weight (s) = saved.weight (slot);
+      if (table_->tracks_l1 ())
+        table_->l1_applied (s) = saved.l1_applied (slot);
+    }
+    else
+    {
+      StoreWeight (index, saved.weight (slot));
+      if (l1_applied_)
+        l1_applied_[index] = saved.l1_applied (slot);
+    }
+  }
+  bias_          = checkpoint_->bias;
+  scale_         = checkpoint_->scale;
+  squaredL2Norm_ = checkpoint_->squaredL2Norm;
+  norm_stale_    = checkpoint_->norm_stale;
+  l1_penalty_    = checkpoint_->l1_penalty;
+  ReleaseCheckpoint ();
+}
+
+
+void WeightVector::ReleaseCheckpoint ()
+{
+  delete checkpoint_;
+  checkpoint_ = NULL;
+}
+
+
+// Save stored weight and applied L1 penalty of index unless already saved.
+// Weights added later get the penalty of the checkpoint, so they remain 0.
+void WeightVector::SaveWeight (int index)
+{
+  WeightTable &saved = checkpoint_->saved;
+  int size = saved.size ();
+  int slot = saved.Insert (index, checkpoint_->l1_penalty);
+  if (saved.size () == size)
+    return;
+  if (table_)
+  {
+    int s = table_->Find (index);
+    if (s >= 0)
+    {
+      saved.weight (slot) = table_->weight (s);
+      if (table_->tracks_l1 ())
+        saved.l1_applied (slot) = table_->l1_applied (s);
+    }
+  }
+  else
+  {
+    saved.weight (slot) = StoredWeight (index);
+    if (l1_applied_)
+      saved.l1_applied (slot) = l1_applied_[index];
+  }
+}
+
+
+void WeightVector::SaveWeights (const SparseVectorView &rhs)
+{
+  for (int i = 0; i < rhs.size (); ++i)
+    SaveWeight (rhs.id (i));
+}
+
+
+// Start recording the ids of changed weights, e.g. for delta snapshots.
+// Recording costs a hash table insert per changed weight.
+void WeightVector::TrackChanges ()
+{
+  if (!changes_)
+    changes_ = new WeightTable;
+  else
+    changes_->clear ();
+  all_changed_ = false;
+}
+
+
+size_t WeightVector::num_changes () const
+{
+  if (!changes_)
+    return 0;
+  return all_changed_ ? size_ : changes_->size ();
+}
+
+
+void WeightVector::RecordChanges (const SparseVectorView &rhs)
+{
+  for (int i = 0; i < rhs.size (); ++i)
+    changes_->Insert (rhs.id (i), 0);
+}
+
+
+// Get the stored weights, i.e. divided by scale (), and the applied L1
+// penalties of the weights changed since TrackChanges, or of all non-zero
+// weights. Penalties are only returned if lazy_l1 ().
+void WeightVector::GetStoredWeights (bool changed, std::vector<id_t> &ids,
+  std::vector<float> &weights, std::vector<double> &l1_applied) const
+{
+  ids.clear ();
+  weights.clear ();
+  l1_applied.clear ();
+  if (changed && changes_ && !all_changed_)
+  {
+    for (int slot = 0; slot < changes_->capacity (); ++slot)
+    {
+      if (changes_->id (slot) != WeightTable::kEmpty)
+        ids.push_back (changes_->id (slot));
+    }
+  }
+  else if (table_)
+  {
+    for (int slot = 0; slot < table_->capacity (); ++slot)
+    {
+      if ((table_->id (slot) != WeightTable::kEmpty)
+        && (table_->weight (slot) != 0))
+        ids.push_back (table_->id (slot));
+    }
+  }
+  else
+  {
+    for (int i = NextNonZero (0); i < size_; i = NextNonZero (i + 1))
+      ids.push_back (i);
+  }
+  for (size_t k = 0; k < ids.size (); ++k)
+  {
+    float  weight  = 0;
+    double applied = l1_penalty_;
+    if (table_)
+    {
+      int slot = table_->Find (ids[k]);
+      if (slot >= 0)
+      {
+        weight = table_->weight (slot);
+        if (table_->tracks_l1 ())
+          applied = table_->l1_applied (slot);
+      }
+    }
+    else
+    {
+      weight = StoredWeight (ids[k]);
+      if (l1_applied_)
+        applied = l1_applied_[ids[k]];
+    }
+    weights.push_back (weight);
+    if (lazy_l1 ())
+      l1_applied.push_back (applied);
   }
 }
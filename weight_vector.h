@@ -23,40 +23,142 @@
 #ifndef WEIGHT_VECTOR_H
 #define WEIGHT_VECTOR_H
 
+#include <cmath>
 #include <cstring>
 
-#include "sparse_vector.h"
+#include <vector>
+
+#include "float16.h"
+#include "sampler.h"
+#include "sparse_vector_view.h"
+#include "weight_table.h"
+
+
+// Dense weight vector. Weights are stored divided by scale_, so scaling
+// is O(1). L1-regularization is applied lazily: RegularizeL1 only adds
+// to the cumulative penalty and each weight is truncated by the penalty
+// accumulated since its last update when it is accessed. The weights
+// are either owned or external storage, e.g. a mapped model file or a
+// class-interleaved model, where consecutive weights are stride apart.
+// Sparse weight vectors store only weights that were ever updated in a
+// hash table, so their memory is independent of size. The squared L2-norm
+// is updated by every change of the weights. It is recomputed when read
+// after lazy L1 penalties, for external storage and, against rounding
+// drift, after as many changes as there are weights. Owned dense weights
+// can be stored as 16 bit bfloat16 or fp16 numbers, which halves their
+// memory and bandwidth. Computations are in float, updates by PlusEquals
+// are rounded stochastically and all other changes to nearest.
+
+
+// State of a weight vector at a checkpoint. Stored weights and applied L1
+// penalties are saved when they are changed for the first time after the
+// checkpoint, so the cost is proportional to the number of changed weights.
+struct WeightCheckpoint
+{
+  WeightTable saved;                  // Stored weights before first change
+  float  bias;
+  float  scale;
+  double squaredL2Norm;
+  bool   norm_stale;
+  double l1_penalty;
+};
 
 
 class WeightVector
 {
   public:
-    WeightVector (int size);
+    typedef enum { kDense, kSparse } Storage; // Weight storage
+    typedef enum { kFloat32, kBFloat16, kFloat16 } Precision; // Dense
+    static const float kMinScale;     // Smallest scale before rescaling
+    static const float kMinScaleFloat16;  // Same for fp16 weights
+    static const float kMaxFloat16;   // Largest finite fp16 weight
+    WeightVector (int size, Storage storage = kDense,
+      Precision precision = kFloat32, uint64_t seed = 0); // Seed of rounding
+    WeightVector (int size, float *vector, int stride = 1);
     WeightVector (const WeightVector &copy);
     ~WeightVector ();
+    void  Assign (const WeightVector &copy);  // Copy into own storage
 
     int   size () const;
     float bias () const;
     void  set_bias (float bias);
     void  clear ();
+    float scale () const;
+    bool  lazy_l1 () const;           // L1 penalty is applied lazily
+    Precision precision () const;     // Format of stored weights
     float GetWeight (int index) const;
     void  SetWeight (int index, float value);
-    void  PlusEquals (const SparseVector &rhs);
-    void  PlusEquals (float scalar, const SparseVector &rhs);
-    float InnerProduct (const SparseVector &rhs) const;
+    void  GetNonZeros (std::vector<id_t> &ids,
+      std::vector<float> &values) const; // Non-zero weights by id
+    void  PlusEquals (const SparseVectorView &rhs);
+    void  PlusEquals (float scalar, const SparseVectorView &rhs);
+    float InnerProduct (const SparseVectorView &rhs) const;
     void  Scale (float factor);
-    float squaredL2Norm () const;
+    float squaredL2Norm () const;     // Recomputed if stale
+    void  ComputeSquaredL2Norm ();
     void  RegularizeL1 (const float factor);
     void  RegularizeL2 (const float factor);
+    size_t memory_usage () const;     // Bytes used by weights
+    void  Checkpoint ();              // Remember current weights
+    void  RestoreCheckpoint ();       // Return to remembered weights
+    void  ReleaseCheckpoint ();       // Forget remembered weights
+    double l1_penalty () const;       // Cumulative L1 penalty
+    void  TrackChanges ();            // Record changed weights from now
+    size_t num_changes () const;      // Changed weights since TrackChanges
+    size_t num_clamped () const;      // fp16 weights clamped to range
+    void  GetStoredWeights (bool changed, std::vector<id_t> &ids,
+      std::vector<float> &weights,
+      std::vector<double> &l1_applied) const; // Changed or all non-zero
   private:
-    float *vector_;
+    float  StoredWeight (int index) const;  // Weight divided by scale
+    float  ClampFloat16 (float weight);     // Into fp16 range, counted
+    void   StoreWeight (int index, float weight); // Rounded to nearest
+    void   UpdateWeight (int index, float weight); // Rounded randomly
+    int    NextNonZero (int index) const;   // Next non-zero (dense)
+    float  ReducedDot (const SparseVectorView &rhs) const; // 16 bit
+    float  SlotWeight (int slot) const;     // Weight in slot (sparse)
+    float  GetSparseWeight (int index) const;
+    void   SetSparseWeight (int index, float value);
+    void   SaveWeight (int index);    // Save weight for checkpoint
+    void   SaveWeights (const SparseVectorView &rhs);
+    void   Rescale ();                // Multiply stored weights by scale_
+    void   CountNormUpdates (int count);  // Mark norm stale against drift
+    double SumOfSquares () const;     // Squared L2-norm from all weights
+    void   RecordChanges (const SparseVectorView &rhs);
+
+    float *vector_;                   // Float weights or NULL
+    uint16_t *reduced_;               // 16 bit weights or NULL
+    Precision precision_;             // Format of stored weights
+    RandomEngine rounding_;           // Random bits of UpdateWeight
+    bool  owns_vector_;               // Delete vector_ on destruction
+    size_t stride_;                   // Distance of weights in vector_
     float bias_;
     float scale_;
     int   size_;
-    float squaredL2Norm_;
+    mutable double squaredL2Norm_;    // Squared L2-norm of weights
+    mutable bool norm_stale_;         // Recompute squaredL2Norm_ when read
+    mutable size_t norm_updates_;     // Weights changed since computed
+    double  l1_penalty_;              // Cumulative L1 penalty
+    double *l1_applied_;              // Penalty applied per weight or NULL
+    WeightTable *table_;              // Sparse storage or NULL
+    WeightCheckpoint *checkpoint_;    // Remembered state or NULL
+    WeightTable *changes_;            // Ids of changed weights or NULL
+    bool  all_changed_;               // All weights changed (changes_)
+    size_t num_clamped_;              // fp16 weights clamped to range
 };
 
 
+// Truncate weight towards zero by penalty
+inline float truncate_l1 (float weight, double penalty)
+{
+  if (weight > penalty)
+    return weight - penalty;
+  if (weight < - penalty)
+    return weight + penalty;
+  return 0;
+}
+
+
 inline int WeightVector::size () const
 {
   return size_;
@@ -75,34 +177,161 @@ inline void WeightVector::set_bias (float bias)
 }
 
 
+inline float WeightVector::scale () const
+{
+  return scale_;
+}
+
+
+inline bool WeightVector::lazy_l1 () const
+{
+  return l1_applied_ || (table_ && table_->tracks_l1 ());
+}
+
+
+inline WeightVector::Precision WeightVector::precision () const
+{
+  return precision_;
+}
+
+
+inline size_t WeightVector::num_clamped () const
+{
+  return num_clamped_;
+}
+
+
 inline void WeightVector::clear ()
 {
-  memset (vector_, 0, size_ * sizeof (float)); 
+  norm_stale_   = false;
+  norm_updates_ = 0;
+  all_changed_  = (changes_ != NULL);
+  if (table_)
+    table_->clear ();
+  else if (reduced_)
+    memset (reduced_, 0, size_ * sizeof (uint16_t));
+  else if (stride_ == 1)
+    memset (vector_, 0, size_ * sizeof (float)); 
+  else
+  {
+    for (int i = 0; i < size_; ++i)
+      vector_[i * stride_] = 0;
+  }
   squaredL2Norm_ = 0;
+  if (l1_applied_)
+  {
+    for (int i = 0; i < size_; ++i)
+      l1_applied_[i] = l1_penalty_;
+  }
 }
 
 
 inline float WeightVector::GetWeight (int index) const
 {
-  return scale_ * vector_[index];
+  if (table_)
+    return GetSparseWeight (index);
+  if (l1_applied_)
+    return truncate_l1 (scale_ * StoredWeight (index),
+      l1_penalty_ - l1_applied_[index]);
+  return scale_ * StoredWeight (index);
 }
 
 
 inline void WeightVector::SetWeight (int index, float value)
 {
-  vector_[index] = value / scale_;
+  if (checkpoint_)
+    SaveWeight (index);
+  if (changes_)
+    changes_->Insert (index, 0);
+  float old = norm_stale_ ? 0 : GetWeight (index);
+  if (table_)
+    SetSparseWeight (index, value);
+  else
+  {
+    StoreWeight (index, value / scale_);
+    if (l1_applied_)
+      l1_applied_[index] = l1_penalty_;
+  }
+  if (!norm_stale_)
+  {
+    float stored = GetWeight (index); // value as stored, e.g. rounded
+    squaredL2Norm_ += double (stored) * stored - double (old) * old;
+    CountNormUpdates (1);
+  }
+}
+
+
+inline float WeightVector::StoredWeight (int index) const
+{
+  if (!reduced_)
+    return vector_[index * stride_];
+  if (precision_ == kBFloat16)
+    return bf16_to_float (reduced_[index]);
+  return fp16_to_float (reduced_[index]);
+}
+
+
+// Stored fp16 weights beyond +-kMaxFloat16 would become infinite and turn
+// the submodel into NaN with the next update, they are clamped instead
+inline float WeightVector::ClampFloat16 (float weight)
+{
+  if (!(fabsf (weight) > kMaxFloat16))
+    return weight;
+  ++num_clamped_;
+  return (weight > 0) ? kMaxFloat16 : - kMaxFloat16;
 }
 
 
+inline void WeightVector::StoreWeight (int index, float weight)
+{
+  if (!reduced_)
+    vector_[index * stride_] = weight;
+  else if (precision_ == kBFloat16)
+    reduced_[index] = float_to_bf16 (weight);
+  else
+    reduced_[index] = float_to_fp16 (ClampFloat16 (weight));
+}
+
+
+inline void WeightVector::UpdateWeight (int index, float weight)
+{
+  if (!reduced_)
+    vector_[index * stride_] = weight;
+  else if (precision_ == kBFloat16)
+    reduced_[index] = float_to_bf16 (weight, rounding_.Next () >> 32);
+  else
+    reduced_[index] = float_to_fp16 (ClampFloat16 (weight),
+      rounding_.Next () >> 32);
+}
+
+
+// Stored weights are rescaled before scale_ underflows or, for fp16, before
+// they exceed its range. Lazy L1 penalties are not scaled, so truncated
+// weights do not scale with factor and the norm is recomputed.
 inline void WeightVector::Scale (float factor)
 {
   scale_ *= factor;
+  squaredL2Norm_ *= double (factor) * factor;
+  if (lazy_l1 ())
+    norm_stale_ = true;
+  float min_scale = (precision_ == kFloat16) ? kMinScaleFloat16 : kMinScale;
+  if ((scale_ != 0) && (fabs (scale_) < min_scale))
+    Rescale ();
+}
+
+
+// Count changed weights, the norm is recomputed after size () of them
+inline void WeightVector::CountNormUpdates (int count)
+{
+  norm_updates_ += count;
+  if (norm_updates_ > size_t (size_))
+    norm_stale_ = true;
 }
 
 
-inline float WeightVector::squaredL2Norm () const
+inline double WeightVector::l1_penalty () const
 {
-  return squaredL2Norm_;
+  return l1_penalty_;
 }
 
 
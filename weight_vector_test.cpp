@@ -0,0 +1,247 @@
+// Unit test for the squared L2-norm tracking of weight vectors
+//
+// Copyright (C) 2012 Heidelberg University
+//
+// Author: Sascha Fendrich
+//
+// This file is part of Sol.
+// 
+// Sol is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Sol is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with Sol.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cmath>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sampler.h"
+#include "sparse_kernels.h"
+#include "sparse_vector_view.h"
+#include "weight_vector.h"
+
+
+// Random instance with distinct increasing ids, float values, counts or
+// binary values
+struct Instance
+{
+  std::vector<id_t>    ids;
+  std::vector<float>   values;
+  std::vector<uint8_t> counts;
+  float squaredL2Norm;
+  SparseVectorView view () const;
+};
+
+
+SparseVectorView Instance::view () const
+{
+  return SparseVectorView (ids.data (), values.empty () ? NULL
+    : values.data (), ids.size (), 0, squaredL2Norm,
+    counts.empty () ? NULL : counts.data ());
+}
+
+
+static void draw_instance (RandomEngine &random, int size, Instance &x)
+{
+  x.ids.clear ();
+  x.values.clear ();
+  x.counts.clear ();
+  x.squaredL2Norm = 0;
+  int encoding = random.Uniform (3);
+  int num_features = random.Uniform (40) + 1;
+  int step = size / num_features;
+  for (int i = 0; i < num_features; ++i)
+  {
+    x.ids.push_back (i * step + random.Uniform (step));
+    float value = 1;
+    if (encoding == 0)
+    {
+      value = float (random.Uniform (2001)) / 1000 - 1;
+      x.values.push_back (value);
+    }
+    else if (encoding == 1)
+    {
+      value = random.Uniform (5);
+      x.counts.push_back (value);
+    }
+    x.squaredL2Norm += value * value;
+  }
+}
+
+
+// Relative difference of the tracked norm and the norm recomputed from all
+// weights by a copy of w
+static double norm_error (const WeightVector &w, WeightVector &copy)
+{
+  copy.Assign (w);
+  copy.ComputeSquaredL2Norm ();
+  double exact   = copy.squaredL2Norm ();
+  double tracked = w.squaredL2Norm ();
+  return fabs (tracked - exact) / std::max (exact, 1e-6);
+}
+
+
+// Apply a random mix of updates, L1 and L2 regularization, scaling with
+// rescales, set weights and checkpoint restores to w and compare the
+// tracked norm after each step. Return the number of failures.
+static int test_norm (const char *name, WeightVector &w, bool l1,
+  double tolerance)
+{
+  const int kNumSteps = 20000;
+  RandomEngine random (1);
+  WeightVector copy (w.size ());
+  Instance x;
+  double max_error = 0;
+  int rescales  = 0;
+  int restores  = 0;
+  bool checkpoint = false;
+  double checkpoint_norm = 0;
+  int failures = 0;
+  for (int step = 0; step < kNumSteps; ++step)
+  {
+    float old_scale = w.scale ();
+    int op = random.Uniform (100);
+    if (op < 60)
+    {
+      draw_instance (random, w.size (), x);
+      w.PlusEquals ((float (random.Uniform (2001)) / 1000 - 1) / 10,
+        x.view ());
+    }
+    else if (op < 65)
+    {
+      draw_instance (random, w.size (), x);
+      w.PlusEquals (x.view ());
+    }
+    else if (op < 75)
+    {
+      float value = random.Uniform (4) ? float (random.Uniform (2001)) / 1000
+        - 1 : 0;
+      w.SetWeight (random.Uniform (w.size ()), value);
+    }
+    else if (op < 85)
+      w.Scale (random.Uniform (2) ? 0.5 : 0.999);
+    else if (op < 90)
+      w.RegularizeL2 (0.01);
+    else if ((op < 94) && l1)
+      w.RegularizeL1 (1e-4);
+    else if (op >= 94)
+    {
+      if (!checkpoint)
+      {
+        w.Checkpoint ();
+        checkpoint_norm = w.squaredL2Norm ();
+      }
+      else
+      {
+        w.RestoreCheckpoint ();
+        ++restores;
+        if (w.squaredL2Norm () != checkpoint_norm)
+        {
+          std::cerr << "FAILED: " << name << " step " << step
+            << ": restored norm " << w.squaredL2Norm () << ", expected "
+            << checkpoint_norm << std::endl;
+          ++failures;
+        }
+      }
+      checkpoint = !checkpoint;
+    }
+    if (w.scale () > old_scale)
+      ++rescales;
+
+    double error = norm_error (w, copy);
+    max_error = std::max (max_error, error);
+    if ((error > tolerance) && (failures < 10))
+    {
+      std::cerr << "FAILED: " << name << " step " << step
+        << ": relative error of tracked norm " << error << std::endl;
+      ++failures;
+    }
+  }
+  if ((rescales == 0) || (restores == 0))
+  {
+    std::cerr << "FAILED: " << name << ": " << rescales << " rescales, "
+      << restores << " checkpoint restores" << std::endl;
+    ++failures;
+  }
+  std::cout << name << ": max. relative error " << max_error << ", "
+    << rescales << " rescales" << std::endl;
+  return failures;
+}
+
+
+// Weights beyond the fp16 range of the stored weights are clamped and
+// counted instead of becoming infinite, later updates stay finite
+static int test_fp16_range ()
+{
+  const int kSize = 16;
+  WeightVector w (kSize, WeightVector::kDense, WeightVector::kFloat16);
+  w.Scale (1.0 / 200);
+  w.SetWeight (1, 1000);
+  w.SetWeight (2, -1000);
+  id_t ids[] = { 1, 2, 3 };
+  float values[] = { 1, -1, 1 };
+  SparseVectorView x (ids, values, 3, 0, 3);
+  w.PlusEquals (1e6, x);
+  w.Scale (0.5);
+  w.PlusEquals (1, x);
+  int failures = 0;
+  for (int i = 0; i < kSize; ++i)
+  {
+    if (!std::isfinite (w.GetWeight (i)))
+    {
+      std::cerr << "FAILED: fp16 range: weight " << i << " is "
+        << w.GetWeight (i) << std::endl;
+      ++failures;
+    }
+  }
+  if ((w.num_clamped () == 0) || !std::isfinite (w.squaredL2Norm ()))
+  {
+    std::cerr << "FAILED: fp16 range: " << w.num_clamped ()
+      << " clamped weights, squared norm " << w.squaredL2Norm ()
+      << std::endl;
+    ++failures;
+  }
+  std::cout << "fp16 range: " << w.num_clamped () << " clamped weights"
+    << std::endl;
+  return failures;
+}
+
+
+int main ()
+{
+  const int kSize = 1000;
+  const int kStride = 3;
+  int failures = 0;
+  SelectKernels (kKernelsAuto);
+  for (int l1 = 0; l1 <= 1; ++l1)
+  {
+    std::string suffix = l1 ? " with L1" : "";
+    WeightVector dense (kSize);
+    failures += test_norm (("dense" + suffix).c_str (), dense, l1, 1e-5);
+    WeightVector sparse (kSize, WeightVector::kSparse);
+    failures += test_norm (("sparse" + suffix).c_str (), sparse, l1, 1e-5);
+    std::vector<float> storage (kSize * kStride, 0);
+    WeightVector strided (kSize, storage.data (), kStride);
+    failures += test_norm (("strided" + suffix).c_str (), strided, l1, 1e-5);
+    WeightVector bf16 (kSize, WeightVector::kDense, WeightVector::kBFloat16);
+    failures += test_norm (("bf16" + suffix).c_str (), bf16, l1, 1e-5);
+    WeightVector fp16 (kSize, WeightVector::kDense, WeightVector::kFloat16);
+    failures += test_norm (("fp16" + suffix).c_str (), fp16, l1, 1e-5);
+  }
+  failures += test_fp16_range ();
+  std::cout << (failures ? "FAILED" : "passed") << std::endl;
+  return failures ? 1 : 0;
+}